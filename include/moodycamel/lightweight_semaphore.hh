@@ -0,0 +1,98 @@
+// Lightweight counting semaphore from moodycamel::BlockingConcurrentQueue.
+// ©2015-2020 Cameron Desrochers. Distributed under the terms of the simplified
+// BSD license, available at the top of concurrent_queue.hh.
+// Also dual-licensed under the Boost Software License (see LICENSE.md)
+// Uses Jeff Preshing's semaphore implementation (under the terms of its
+// separate zlib license, see lightweightsemaphore.h upstream).
+//
+// Trimmed to the subset used by ntv. The OS semaphore underneath
+// LightweightSemaphore is std::counting_semaphore, so no platform headers are
+// needed.
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <semaphore>
+#include <type_traits>
+
+namespace moodycamel {
+
+// Counting semaphore that spins briefly in user space before falling back to
+// the OS. signal() only enters the kernel when a waiter is actually asleep.
+class LightweightSemaphore {
+public:
+  typedef std::make_signed<std::size_t>::type ssize_t;
+
+  explicit LightweightSemaphore(ssize_t initialCount = 0, int maxSpins = 10000)
+    : m_count(initialCount), m_sema(0), m_maxSpins(maxSpins) {}
+
+  bool tryWait() {
+    ssize_t oldCount = m_count.load(std::memory_order_relaxed);
+    while (oldCount > 0) {
+      if (m_count.compare_exchange_weak(oldCount, oldCount - 1,
+                                        std::memory_order_acquire,
+                                        std::memory_order_relaxed))
+        return true;
+    }
+    return false;
+  }
+
+  bool wait() { return tryWait() || waitWithPartialSpinning(); }
+
+  // timeout_usecs < 0 waits forever, 0 never blocks.
+  bool wait(std::int64_t timeout_usecs) {
+    return tryWait() || waitWithPartialSpinning(timeout_usecs);
+  }
+
+  void signal(ssize_t count = 1) {
+    ssize_t oldCount = m_count.fetch_add(count, std::memory_order_release);
+    ssize_t toRelease = -oldCount < count ? -oldCount : count;
+    if (toRelease > 0) m_sema.release(static_cast<std::ptrdiff_t>(toRelease));
+  }
+
+private:
+  bool osWait(std::int64_t timeout_usecs) {
+    if (timeout_usecs < 0) {
+      m_sema.acquire();
+      return true;
+    }
+    return m_sema.try_acquire_for(std::chrono::microseconds(timeout_usecs));
+  }
+
+  bool waitWithPartialSpinning(std::int64_t timeout_usecs = -1) {
+    ssize_t oldCount;
+    int spin = m_maxSpins;
+    while (--spin >= 0) {
+      oldCount = m_count.load(std::memory_order_relaxed);
+      if ((oldCount > 0) &&
+          m_count.compare_exchange_strong(oldCount, oldCount - 1,
+                                          std::memory_order_acquire,
+                                          std::memory_order_relaxed))
+        return true;
+      std::atomic_signal_fence(std::memory_order_acquire);
+    }
+    oldCount = m_count.fetch_sub(1, std::memory_order_acquire);
+    if (oldCount > 0) return true;
+    if (timeout_usecs != 0 && osWait(timeout_usecs)) return true;
+    // Timed out: undo our decrement, unless a signal() raced with us, in which
+    // case its OS token is ours to consume.
+    while (true) {
+      oldCount = m_count.load(std::memory_order_acquire);
+      if (oldCount >= 0 && m_sema.try_acquire()) return true;
+      if (oldCount < 0 &&
+          m_count.compare_exchange_strong(oldCount, oldCount + 1,
+                                          std::memory_order_relaxed,
+                                          std::memory_order_relaxed))
+        return false;
+    }
+  }
+
+  std::atomic<ssize_t> m_count;
+  std::counting_semaphore<> m_sema;
+  int m_maxSpins;
+};
+
+}  // namespace moodycamel
@@ -0,0 +1,40 @@
+//
+// Created by corgi on 2025 四月 25.
+//
+
+#ifndef CAPTURE_SPEC_HH
+#define CAPTURE_SPEC_HH
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+
+/**
+ * 编码器对输入的需求: 每个包用到的前多少字节、每条流用到的前多少个包。
+ * 读取端据此截断拷贝, shard 据此不再缓存多余的包。0 表示不限。
+ */
+struct CaptureSpec {
+  uint32_t bytesPerPacket{ 0 };
+  uint32_t packetsPerFlow{ 0 };
+
+  /// 一个包需要保存的字节数
+  [[nodiscard]] uint32_t Clamp(uint32_t const caplen) const {
+    return bytesPerPacket == 0 ? caplen : (std::min)(caplen, bytesPerPacket);
+  }
+  /// 已缓存 packets 个包的流是否已够用
+  [[nodiscard]] bool Full(size_t const packets) const {
+    return packetsPerFlow != 0 and packets >= packetsPerFlow;
+  }
+  /// 同时满足两者的需求, 任一方不限则不限
+  [[nodiscard]] CaptureSpec Merge(CaptureSpec const& other) const {
+    auto const wider{ [](uint32_t const a, uint32_t const b) {
+      return a == 0 or b == 0 ? 0 : (std::max)(a, b);
+    } };
+    return CaptureSpec{
+      .bytesPerPacket = wider(bytesPerPacket, other.bytesPerPacket),
+      .packetsPerFlow = wider(packetsPerFlow, other.packetsPerFlow),
+    };
+  }
+};
+
+#endif // CAPTURE_SPEC_HH
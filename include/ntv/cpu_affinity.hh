@@ -0,0 +1,25 @@
+//
+// Created by corgi on 2025 四月 29.
+//
+
+#ifndef CPU_AFFINITY_HH
+#define CPU_AFFINITY_HH
+
+#include <cstddef>
+#include <string_view>
+#include <vector>
+
+/**
+ * 解析 CPU 列表, 形如 "0-7,16,18-19"。
+ * 空串返回空列表(不绑核), 格式错误时记日志并返回空列表。
+ */
+std::vector<unsigned> ParseCpuList(std::string_view list);
+
+/**
+ * 把当前线程绑到 cpus[index % cpus.size()], cpus 为空时什么也不做。
+ * 绑核后线程首次写入的内存由内核分配在该核所在的 NUMA 节点(first-touch)。
+ * @return 是否绑核成功
+ */
+bool PinCurrentThread(std::vector<unsigned> const& cpus, size_t index);
+
+#endif // CPU_AFFINITY_HH
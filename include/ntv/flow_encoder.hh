@@ -0,0 +1,50 @@
+//
+// Created by corgi on 2025 五月 01.
+//
+
+#ifndef FLOW_ENCODER_HH
+#define FLOW_ENCODER_HH
+
+#include <algorithm>
+#include <cstddef>
+#include <memory>
+#include <vector>
+
+#include <opencv2/opencv.hpp>
+
+struct RawPacket;
+
+/**
+ * 流式编码器: 一条流一个实例, 状态随流存放在流表中。
+ * 包到达时立即折叠进状态后即可释放, 流结束时再生成图像。
+ * 状态按已折叠的包按需增长, 上限由编码器的输入需求决定, 与流长无关;
+ * 短流只占它实际用到的内存。
+ * 包可能乱序到达(多个读线程分读同一文件), 编码器保留按到达时间最早的那些包,
+ * 已够用后再来的更早的包替换最晚的, 生成图像时按到达时间排序。
+ */
+class FlowEncoder {
+public:
+  virtual ~FlowEncoder() = default;
+  /// 折叠一个包, 返回 true 表示已够用, 之后到达时间更晚的包不再需要
+  virtual bool Add(RawPacket const& packet) = 0;
+  /// 生成图像, 每个实例只调用一次
+  virtual cv::Mat Finalize() = 0;
+  /// 状态占用的字节数, 计入内存预算; Add 后只增不减, 调用方按差值记账
+  [[nodiscard]] virtual size_t Footprint() const = 0;
+};
+
+/**
+ * 编码器状态的容器按需扩容: 仍按倍数增长, 但容量不超过 limit,
+ * 流再长也不会比一次预留上限占用更多。
+ */
+template <typename T>
+void GrowCapped(std::vector<T>& items, size_t const needed,
+                size_t const limit) {
+  if (needed <= items.capacity()) return;
+  items.reserve((std::min)((std::max)(items.capacity() * 2, needed), limit));
+}
+
+/// 创建一条流的编码器状态
+using encoder_factory_t = std::unique_ptr<FlowEncoder> (*)();
+
+#endif // FLOW_ENCODER_HH
@@ -8,6 +8,10 @@
 #include <cstdint>
 #include <functional>
 
+#if defined(_MSC_VER) && defined(_M_X64)
+#include <intrin.h>
+#endif
+
 
 struct FlowKey {
   uint32_t ip1;
@@ -15,15 +19,46 @@ struct FlowKey {
   uint16_t port1;
   uint16_t port2;
   uint8_t  protocol;
+  // 所属 pcap 文件编号, 批量模式下区分不同文件中相同五元组的流
+  uint16_t source{};
 
   bool operator==(const FlowKey&) const = default;
 };
 
+namespace detail {
+/// 64x64 -> 128 位乘法, 高低两半异或
+inline uint64_t Mum(uint64_t const a, uint64_t const b) noexcept {
+#if defined(_MSC_VER) && defined(_M_X64)
+  uint64_t hi;
+  uint64_t const lo{ _umul128(a, b, &hi) };
+  return lo ^ hi;
+#else
+  auto const r{ static_cast<unsigned __int128>(a) * b };
+  return static_cast<uint64_t>(r) ^ static_cast<uint64_t>(r >> 64);
+#endif
+}
+} // namespace detail
+
+/**
+ * wyhash 风格的 FlowKey 散列: 两次 128 位乘法混合, 所有位都充分扩散,
+ * 低位(选 shard)和高位(流表下标)可以分别使用。
+ * @param seed 不同的 seed 得到独立的分布, 见 ParseOption::hashSeed
+ */
+inline uint64_t HashFlowKey(FlowKey const& k, uint64_t const seed = 0) noexcept {
+  uint64_t const a{ static_cast<uint64_t>(k.ip1) << 32 | k.ip2 };
+  uint64_t const b{ static_cast<uint64_t>(k.port1) << 48 |
+                    static_cast<uint64_t>(k.port2) << 32 |
+                    static_cast<uint64_t>(k.protocol) << 16 | k.source };
+  uint64_t const h{ detail::Mum(a ^ seed ^ 0xa0761d6478bd642full,
+                                b ^ 0xe7037ed1a0b428dbull) };
+  return detail::Mum(h ^ 0x8ebc6af09c88c6e3ull, seed ^ 0x589965cc75374cc3ull);
+}
+
 namespace std {
 template <>
 struct hash<FlowKey> {
   inline size_t operator()(FlowKey const& k) const noexcept {
-    return ((size_t)k.ip1 << 32 ^ k.ip2) ^ ((size_t)k.port1 << 16 ^ k.port2) ^ k.protocol;
+    return static_cast<size_t>(HashFlowKey(k));
   }
 };
 }
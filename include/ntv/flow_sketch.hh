@@ -0,0 +1,65 @@
+//
+// Created by corgi on 2025 四月 28.
+//
+
+#ifndef FLOW_SKETCH_HH
+#define FLOW_SKETCH_HH
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+/**
+ * Count-Min 计数草图, 读线程本地使用, 用于发现大流。
+ * 只会高估不会低估; 每 AGING_PACKETS 个包所有计数减半, 反映近期的包速。
+ * 参数是 HashFlowKey 的结果, 各行从中取不同的位段。
+ */
+class FlowSketch {
+public:
+  static constexpr size_t ROWS          = 4;
+  static constexpr size_t WIDTH_BITS    = 12;
+  static constexpr size_t WIDTH         = size_t{ 1 } << WIDTH_BITS;
+  static constexpr uint64_t AGING_PACKETS = 1 << 16;
+
+  /// 计入一个包, 返回该流的估计包数
+  uint32_t Add(uint64_t hash);
+
+private:
+  void Age();
+
+  std::array<std::array<uint32_t, WIDTH>, ROWS> mCounters{};
+  uint64_t mAdded{ 0 };
+};
+
+/**
+ * 近期出现过的流的集合(两代 Bloom filter 轮换)。
+ * 一代覆盖 window 时长, 不在任何一代中的流至少已空闲一整代,
+ * 不会有假阴性; 假阳性只会让调用方更保守。
+ */
+class SeenFilter {
+public:
+  /// window_us 为 0 时不轮换
+  explicit SeenFilter(uint64_t window_us);
+
+  /// 记下该流, 返回之前是否见过
+  bool TestAndSet(uint64_t hash, uint64_t now_us);
+  /// 当前一代的起始时间, 调用方据此清理自己的过期记录
+  [[nodiscard]] uint64_t GenerationStart() const { return mStart; }
+
+private:
+  static constexpr size_t BITS_LOG = 20;
+  static constexpr size_t BITS     = size_t{ 1 } << BITS_LOG;
+  static constexpr size_t HASHES   = 3;
+
+  [[nodiscard]] static bool Test(std::vector<uint64_t> const& bits,
+                                 uint64_t hash);
+  static void Set(std::vector<uint64_t>& bits, uint64_t hash);
+
+  uint64_t mWindow;
+  uint64_t mStart{ 0 };
+  std::vector<uint64_t> mCurrent;
+  std::vector<uint64_t> mPrevious;
+};
+
+#endif // FLOW_SKETCH_HH
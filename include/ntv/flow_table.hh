@@ -0,0 +1,120 @@
+//
+// Created by corgi on 2025 四月 27.
+//
+
+#ifndef FLOW_TABLE_HH
+#define FLOW_TABLE_HH
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include <ntv/flow_encoder.hh>
+#include <ntv/flow_key.hh>
+#include <ntv/raw_packet.hh>
+#include <ntv/usings.hh>
+
+enum class FlowState : uint8_t {
+  /// 正在缓存包
+  Active,
+  /// 已提前写出的墓碑, 之后的包只计数不缓存
+  Satisfied,
+};
+
+/// 流表项: 键与每条流的元数据放在一起, 一次查找全部拿到
+struct FlowEntry {
+  FlowKey key{};
+  /// 最后一个包的时间(µs), 时钟由调用方决定
+  uint64_t lastSeen{};
+  /// 见到的包数和原始字节数, 含墓碑之后丢弃的
+  uint64_t packets{};
+  uint64_t bytes{};
+  FlowState state{ FlowState::Active };
+  /// 所属文件由多个读线程分段读取, 包不按到达时间来, 够用后也不能提前写出
+  bool shared{ false };
+  /// 当前缓存段首包的包时间(µs), 用于活动超时
+  int64_t start{};
+  /// 缓存的包; 所有输出格式都支持流式时改为折叠进 encoders, list 始终为空
+  packet_list_t list{};
+  /// 每个输出格式一个, 顺序与格式列表一致
+  std::vector<std::unique_ptr<FlowEncoder>> encoders{};
+
+  /// 是否有待写出的内容
+  [[nodiscard]] bool Pending() const {
+    return not encoders.empty() or not list.empty();
+  }
+};
+
+/**
+ * shard 私有的开放寻址流表(Robin Hood 探测)。
+ * 表项内联存放在一块连续数组中, 删除用后移填补, 不留墓碑槽位,
+ * 长期运行后探测长度也不会退化。
+ * @note 插入和删除都会移动其他表项, 之前拿到的指针随之失效。
+ */
+class FlowTable {
+public:
+  explicit FlowTable(size_t reserve = 0, uint64_t seed = 0);
+  /// 换散列种子, 只能在表为空时调用
+  void Seed(uint64_t seed) { mSeed = seed; }
+
+  /// 预留至少能容纳 flows 条流的容量, 之后插入不再扩容
+  void Reserve(size_t flows);
+  [[nodiscard]] FlowEntry* Find(FlowKey const& key);
+  /// 查找或插入, 返回表项和是否新插入
+  std::pair<FlowEntry*, bool> TryEmplace(FlowKey const& key);
+  bool Erase(FlowKey const& key);
+  /**
+   * 删除所有 pred(entry) 为 true 的表项, pred 可以移走 entry.list。
+   * 遍历中表项会后移, 未删除的表项可能被 pred 检查两次。
+   */
+  template <typename Pred>
+  void EraseIf(Pred&& pred);
+  template <typename Fn>
+  void ForEach(Fn&& fn);
+  void Clear();
+
+  [[nodiscard]] size_t Size() const { return mSize; }
+  [[nodiscard]] bool Empty() const { return mSize == 0; }
+  [[nodiscard]] size_t Capacity() const { return mSlots.size(); }
+
+private:
+  // 负载因子上限 7/8
+  static constexpr size_t LOAD_NUM = 7;
+  static constexpr size_t LOAD_DEN = 8;
+  static constexpr size_t MIN_CAPACITY = 16;
+
+  [[nodiscard]] size_t Home(FlowKey const& key) const;
+  void Rehash(size_t capacity);
+  /// 删除 index 处的表项, 后面同一簇的表项依次前移
+  void EraseAt(size_t index);
+
+  std::vector<FlowEntry> mSlots;
+  /// 探测距离 + 1, 0 表示空槽
+  std::vector<uint16_t> mDist;
+  size_t mMask{ 0 };
+  size_t mSize{ 0 };
+  int mShift{ 64 };
+  uint64_t mSeed{ 0 };
+};
+
+template <typename Pred>
+void FlowTable::EraseIf(Pred&& pred) {
+  for (size_t i = 0; i < mSlots.size();) {
+    if (mDist[i] != 0 and pred(mSlots[i])) {
+      // 后继前移到 i, 原地再检查一次
+      EraseAt(i);
+      continue;
+    }
+    ++i;
+  }
+}
+
+template <typename Fn>
+void FlowTable::ForEach(Fn&& fn) {
+  for (size_t i = 0; i < mSlots.size(); ++i) {
+    if (mDist[i] != 0) fn(mSlots[i]);
+  }
+}
+
+#endif // FLOW_TABLE_HH
@@ -3,17 +3,79 @@
 //
 
 #pragma once
+#include <string>
+
+#include <ntv/capture_spec.hh>
+#include <ntv/flow_encoder.hh>
 #include <ntv/raw_packet.hh>
 #include <ntv/usings.hh>
 #include <opencv2/opencv.hpp>
 
 class GAF {
 public:
-  explicit GAF(const packet_list_t& packets, int target_len = 64);
+  /// 时间序列的来源
+  enum class Series : uint8_t {
+    /// 整条流的前 len 个字节, 除以 255
+    Bytes,
+    /// 前 len 个包的原始长度, 按最小/最大值缩放到 [0, 1]
+    Lengths,
+    /// 前 len 个包的到达间隔(首个为 0), 按最小/最大值缩放到 [0, 1]
+    Intervals,
+  };
+  enum class Field : uint8_t {
+    /// cos(φi + φj), 负值截为 0(与原输出一致)
+    Summation,
+    /// sin(φi - φj), [-1, 1] 线性映射到 [0, 255]
+    Difference,
+  };
+  struct Params {
+    int len{ 64 };
+    Series series{ Series::Bytes };
+    Field field{ Field::Summation };
+  };
+  /// 按 ParseOption 中的 gaf* 选项取参数
+  static Params FromOptions();
+
+  /// 收集前 len 个字节或前 len 个包的长度/时间, 够了即停
+  class Stream final : public FlowEncoder {
+  public:
+    explicit Stream(Params const& params);
+    bool Add(RawPacket const& packet) override;
+    cv::Mat Finalize() override;
+    [[nodiscard]] size_t Footprint() const override;
+
+  private:
+    /// 一个包的贡献: 字节序列时为其字节在 mBytes 中的位置, 否则 size 为包长
+    struct Chunk {
+      int64_t arrive;
+      uint32_t offset;
+      uint32_t size;
+    };
+    [[nodiscard]] std::vector<float> BuildSeries() const;
+    /// 字节序列: 插入比已保留的包更早的包, 按到达时间重排后只留前 len 字节
+    void Merge(int64_t arrive, uchar const* data, size_t size);
+
+    Params mParams;
+    size_t mLen;
+    std::vector<uchar> mBytes;
+    std::vector<Chunk> mChunks;
+    /// 字节序列中已保留的包的最晚到达时间
+    int64_t mLatest{ 0 };
+  };
+
+  GAF(const packet_list_t& packets, Params const& params);
+  /// 字节序列只用到前 len 字节, 长度/间隔序列只用到前 len 个包的包头信息
+  static CaptureSpec Capture(Params const& params);
   [[nodiscard]] cv::Mat getMatrix() const;
 
 private:
-  static std::vector<float> extractTimeSeries(const packet_list_t& packets, int len);
-  static cv::Mat computeGAF(const std::vector<float>& series);
+  /**
+   * 外积形式计算, 不逐格求三角函数: 设 s = √(1 - x²),
+   * GASF = x_i·x_j - s_i·s_j, GADF = s_i·x_j - x_i·s_j。
+   * 每行是两个向量的线性组合, 内层循环连续访存可被编译器向量化。
+   * @param series 取值在 [0, 1]
+   * @return len x len 的 CV_8UC1 图像
+   */
+  static cv::Mat computeGAF(const std::vector<float>& series, Field field);
   cv::Mat matrix_;
-};
\ No newline at end of file
+};
@@ -0,0 +1,54 @@
+﻿//
+// Created by corgi on 2025 四月 23.
+//
+
+#ifndef MEMORY_BUDGET_HH
+#define MEMORY_BUDGET_HH
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+
+/**
+ * 全局内存预算。
+ * 记账对象: 存放包的 slab(含链表节点估算)、shard 中的流表项、流式编码器状态;
+ * 待写出的流由其中的包所在 slab 或编码器状态计入。超出上限时读线程阻塞, shard 提前驱逐流。
+ */
+class MemoryBudget {
+public:
+  void SetLimit(int64_t bytes) { mLimit.store(bytes); }
+  [[nodiscard]] int64_t Limit() const { return mLimit.load(); }
+
+  void Charge(int64_t bytes);
+  void Release(int64_t bytes);
+  /// 是否已达上限(上限 <= 0 表示不限)
+  [[nodiscard]] bool Over() const;
+
+  /// 读线程调用: 超出上限时阻塞, 直到有内存被释放
+  void WaitForRoom();
+  /// shard 每驱逐一条流调用一次
+  void CountEviction() { mEvictions.fetch_add(1, std::memory_order_relaxed); }
+
+  [[nodiscard]] int64_t Used() const { return mUsed.load(); }
+  [[nodiscard]] int64_t Peak() const { return mPeak.load(); }
+  [[nodiscard]] uint64_t BackpressureCount() const { return mBlocked.load(); }
+  [[nodiscard]] std::chrono::milliseconds BackpressureTime() const {
+    return std::chrono::milliseconds{ mBlockedMs.load() };
+  }
+  [[nodiscard]] uint64_t EvictionCount() const { return mEvictions.load(); }
+
+private:
+  std::atomic<int64_t> mLimit{ 0 };
+  std::atomic<int64_t> mUsed{ 0 };
+  std::atomic<int64_t> mPeak{ 0 };
+  std::atomic<uint64_t> mBlocked{ 0 };
+  std::atomic<int64_t> mBlockedMs{ 0 };
+  std::atomic<uint64_t> mEvictions{ 0 };
+  std::atomic<int> mWaiters{ 0 };
+  std::mutex mMutex;
+  std::condition_variable mCv;
+};
+
+#endif // MEMORY_BUDGET_HH
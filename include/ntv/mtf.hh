@@ -8,6 +8,10 @@
 #include <memory>
 #include <vector>
 
+#include <ntv/aligned_packet.hh>
+#include <ntv/capture_spec.hh>
+#include <ntv/flow_encoder.hh>
+#include <ntv/nibble_transitions.hh>
 #include <ntv/raw_packet.hh>
 #include <ntv/usings.hh>
 
@@ -15,29 +19,61 @@
 
 class MTF {
 public:
+  /// 逐包计算转移矩阵, 只保留前 cols*cols 个包的 16x16 结果
+  class Stream final : public FlowEncoder {
+  public:
+    explicit Stream(int cols = 4);
+    bool Add(RawPacket const& packet) override;
+    cv::Mat Finalize() override;
+    [[nodiscard]] size_t Footprint() const override;
+
+  private:
+    struct Slot {
+      int64_t arrive;
+      transition_counts_t counts;
+    };
+    int mCols;
+    std::vector<Slot> mSlots;
+  };
+
   explicit MTF(const packet_list_t& packets, int cols = 4);
+  /// 只用到前 cols*cols 个包, 每个包全部字节
+  static CaptureSpec Capture(int cols = 4);
 
   [[nodiscard]] cv::Mat Matrix() const;
 
 private:
   cv::Mat matrix_;
-  // 将数据包转换为0-15的整数序列
-  static std::vector<int> processPacket(const raw_packet_t& packet);
-  // 生成转移概率矩阵
-  static cv::Mat computeTransitionMatrix(const std::vector<int>& transitions);
-  // 平铺矩阵生成图像
-  static cv::Mat tileImages(const std::vector<cv::Mat>& images, int cols,
-                            int dim);
 };
 
 class Tile {
 public:
+  /// 逐包生成对齐后的 192 字节, 只保留填满画布所需的包
+  class Stream final : public FlowEncoder {
+  public:
+    explicit Stream(int width = 64);
+    bool Add(RawPacket const& packet) override;
+    cv::Mat Finalize() override;
+    [[nodiscard]] size_t Footprint() const override;
+
+  private:
+    struct Slot {
+      int64_t arrive;
+      AlignedPacket packet;
+    };
+    int mWidth;
+    size_t mBytes{ 0 };
+    std::vector<Slot> mSlots;
+  };
+
   /**
    *
    * @param packets
    * @param width
    */
-  explicit Tile(packet_list_t packets, int width = 64);
+  explicit Tile(const packet_list_t& packets, int width = 64);
+  /// 画布能放下的包数, 每个包只用到 L4 头之后 64 字节为止
+  static CaptureSpec Capture(int width = 64);
 
   /**
    * Matrix函数
@@ -51,8 +87,7 @@ public:
   [[nodiscard]] cv::Mat Matrix() const;
 
 private:
-  packet_list_t m_packets;
-  int m_width;
+  cv::Mat m_matrix;
 };
 
 #endif // MTF_HH
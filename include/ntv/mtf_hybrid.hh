@@ -4,21 +4,46 @@
 
 
 #pragma once
+#include <ntv/flow_encoder.hh>
+#include <ntv/nibble_transitions.hh>
 #include <ntv/raw_packet.hh>
 #include <ntv/usings.hh>
 #include <opencv2/opencv.hpp>
 
+/**
+ * 64x64 的 4x4 平铺: 左上角为整条流(包首尾相接)的转移矩阵,
+ * 其余 15 块依次为前 15 个包各自的转移矩阵。
+ */
 class MTFHybrid {
 public:
+  /// 每个包只读一遍, 同时累加整流和单包计数; 超出 15 个包后只累加整流
+  class Stream final : public FlowEncoder {
+  public:
+    Stream();
+    bool Add(RawPacket const& packet) override;
+    cv::Mat Finalize() override;
+    [[nodiscard]] size_t Footprint() const override;
+
+  private:
+    struct Slot {
+      int64_t arrive;
+      transition_counts_t counts;
+    };
+    transition_counts_t mGlobal{};
+    /// 上一个包的最后一个字节, 用于包之间的转移
+    int mLast{ -1 };
+    std::vector<Slot> mSlots;
+  };
+
   explicit MTFHybrid(const packet_list_t& packets);
 
   cv::Mat getMatrix() const;
 
+  static constexpr int COLS = 4;
+  static constexpr int DIM = 16;
+  /// 单包矩阵的块数, 第一块留给整流矩阵
+  static constexpr size_t LOCAL_TILES = COLS * COLS - 1;
+
 private:
-  static std::vector<int> extractAllTransitions(const packet_list_t& packets);
-  static std::vector<cv::Mat> extractLocalMTFs(const packet_list_t& packets, int count);
-  static cv::Mat computeMTF(const std::vector<int>& transitions);
-  static cv::Mat tileMTFs(const std::vector<cv::Mat>& tiles, int cols, int dim);
   cv::Mat matrix_;
 };
-
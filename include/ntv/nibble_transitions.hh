@@ -0,0 +1,34 @@
+//
+// Created by corgi on 2025 五月 02.
+//
+
+#ifndef NIBBLE_TRANSITIONS_HH
+#define NIBBLE_TRANSITIONS_HH
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+using u_char = unsigned char;
+
+/// 16x16 半字节转移计数, 下标为 (前一个半字节 << 4) | 后一个半字节
+using transition_counts_t = std::array<uint32_t, 256>;
+
+/**
+ * 把 data 看作半字节序列(每字节先高后低), 将相邻半字节的转移累加到 counts。
+ * 字节内的转移下标就是字节本身, 跨字节的转移 (低半字节, 下一字节高半字节)
+ * 按 AVX2/SSE2/NEON 整批计算下标, 无 SIMD 时逐字节计算。
+ * 不含与前一段数据之间的转移, 需要时由调用方自行累加。
+ */
+void CountNibbleTransitions(u_char const* data, size_t len,
+                            transition_counts_t& counts);
+
+/**
+ * 按行归一化为转移概率再乘 255 取整, 写入 16x16 的 8 位图像块。
+ * 全零的行保持为 0。
+ * @param stride 目标图像一行的字节数
+ */
+void WriteTransitionTile(transition_counts_t const& counts, u_char* out,
+                         size_t stride);
+
+#endif // NIBBLE_TRANSITIONS_HH
@@ -0,0 +1,48 @@
+﻿//
+// Created by corgi on 2025 四月 24.
+//
+
+#ifndef PACKET_ARENA_HH
+#define PACKET_ARENA_HH
+
+#include <cstddef>
+#include <cstdint>
+
+#include <pcap/pcap.h>
+
+#include <ntv/raw_packet.hh>
+
+/**
+ * 读线程独占的包分配器。
+ * 包头和字节数据顺序写入当前 slab, 每个包只是一次指针递增和一次 memcpy。
+ * slab 以偏置计数管理: 启用时计数置为 BIAS, 分配包不碰原子变量,
+ * 写满换新时一次性扣掉 BIAS 与已发出句柄数之差。之后各句柄释放时递减,
+ * 归零即整块回收到全局池。
+ */
+class PacketArena {
+public:
+  /// 常规 slab 大小
+  static constexpr size_t SLAB_BYTES = 256 << 10;
+  /// 超过该大小的包单独占用一块 slab, 不进池
+  static constexpr size_t LARGE_PACKET = SLAB_BYTES / 8;
+
+  PacketArena() = default;
+  ~PacketArena();
+
+  PacketArena(PacketArena const&)            = delete;
+  PacketArena& operator=(PacketArena const&) = delete;
+
+  /// 复制包头、描述和前 length 字节, 返回指向 slab 内副本的句柄
+  raw_packet_t Allocate(pcap_pkthdr const* pkthdr, u_char const* packet,
+                        PacketMeta const& meta, uint32_t length);
+
+private:
+  /// 交出当前 slab 的偏置计数, 之后由各句柄决定何时回收
+  void Retire();
+
+  PacketSlab* mSlab{ nullptr };
+  size_t mUsed{ 0 };
+  int64_t mIssued{ 0 };
+};
+
+#endif // PACKET_ARENA_HH
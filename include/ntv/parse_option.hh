@@ -9,11 +9,46 @@
 #include <utility>
 
 using namespace std::chrono_literals;
+
+/// 单个协议的流超时, 0 表示不启用
+struct FlowTimeout {
+  // 无新包超过该时长即结束
+  std::chrono::seconds idle{ 10s };
+  // 从首包起超过该时长即切分为新流
+  std::chrono::seconds active{ 0s };
+};
+
 struct ParseOption {
   std::string filter{ "ip or vlan" };
   decltype(10ms) timeout{ 10s };
   std::string outfmt{"image"};
   std::string outdir{};
+  // 读取方式: mmap(默认, 经典pcap) | pcap(libpcap pcap_loop)
+  std::string reader{ "mmap" };
+  // mmap 模式下单个文件的并发读取线程数, 0 为自动
+  size_t readers{ 0 };
+  // 批量模式下同时处理的文件数, 0 为自动
+  size_t jobs{ 0 };
+  // 内存预算(MB), 超出时读线程阻塞、shard 提前驱逐流; 0 为不限
+  size_t memoryMB{ 8192 };
+  // 流超时的时钟: packet(包时间戳, 离线默认, 结果可复现) | wall(墙钟, 实时抓包)
+  std::string clock{ "packet" };
+  FlowTimeout tcp{};
+  FlowTimeout udp{};
+  // FlowKey 散列种子, 决定 shard 分配和流表布局
+  uint64_t hashSeed{ 0 };
+  // 流表 shard 线程数和写线程数, 0 为自动(给了 CPU 列表时每核一个, 否则 16 / 4)
+  size_t shards{ 0 };
+  size_t writers{ 0 };
+  // 各类线程可用的 CPU 列表(如 "0-7,16"), 按线程序号轮流绑定; 空为不绑核。
+  // 读线程只绑 mmap 分段读取时自建的线程, libpcap 在调用者线程里读, 不绑
+  std::string readerCpus{};
+  std::string shardCpus{};
+  std::string writerCpus{};
+  // GAF 的边长、序列来源(bytes | lengths | intervals)和类型(gasf | gadf)
+  size_t gafLen{ 64 };
+  std::string gafSeries{ "bytes" };
+  std::string gafField{ "gasf" };
 
   ParseOption() = default;
   ParseOption(std::string filter, int64_t const timeout)
@@ -23,16 +58,8 @@ struct ParseOption {
   ParseOption(ParseOption const& other)            = default;
   ParseOption& operator=(ParseOption const& other) = default;
 
-  ParseOption(ParseOption&& other) noexcept
-      : filter{ std::move(other.filter) }
-      , timeout{ other.timeout } {}
-
-  ParseOption& operator=(ParseOption&& other) noexcept {
-    if (this == &other) return *this;
-    filter  = std::move(other.filter);
-    timeout = other.timeout;
-    return *this;
-  }
+  ParseOption(ParseOption&& other) noexcept            = default;
+  ParseOption& operator=(ParseOption&& other) noexcept = default;
 };
 
 #endif // PARSE_OPTION_HH
@@ -4,46 +4,381 @@
 #include <condition_variable>
 #include <cstdint>
 #include <filesystem>
+#include <future>
+#include <latch>
 #include <list>
 #include <memory>
 #include <mutex>
+#include <optional>
+#include <shared_mutex>
 #include <unordered_map>
 
 #include <moodycamel/concurrent_queue.hh>
+#include <moodycamel/lightweight_semaphore.hh>
+#include <ntv/capture_spec.hh>
+#include <ntv/cpu_affinity.hh>
 #include <ntv/flow_key.hh>
+#include <ntv/flow_sketch.hh>
+#include <ntv/flow_table.hh>
+#include <ntv/packet_arena.hh>
 #include <ntv/raw_packet.hh>
+#include <ntv/spsc_ring.hh>
+#include <ntv/timer_wheel.hh>
 #include <ntv/usings.hh>
+#include <ntv/work_stealing.hh>
 
 class PcapParser {
 public:
   PcapParser();
   ~PcapParser();
-  void ParseFile(std::filesystem::path const& pcap_file);
+  /**
+   * 解析单个文件, 输出到 ParseOption::outdir, 多个输出格式时各写到 outdir/<格式>。
+   * 读取在调用线程内完成后立即返回, shard/写线程在多次调用间常驻复用。
+   * @return 该文件所有流都写出后就绪的 future
+   */
+  std::future<void> ParseFile(std::filesystem::path const& pcap_file);
+  /**
+   * 批量模式: 递归解析目录下所有 pcap, 并发文件数受 ParseOption::jobs 限制。
+   * 输出目录镜像输入的子目录(label)结构, 文件名以 pcap 文件名为前缀。
+   * 返回时所有文件均已写出。
+   */
+  void ParseDirectory(std::filesystem::path const& input_dir);
 
   static void DeadHandler(u_char* user_data, const pcap_pkthdr* pkthdr,
                           const u_char* packet);
 
 private:
-  struct FlowShard {
-    moodycamel::ConcurrentQueue<raw_packet_t> packetQueue;
-    std::unordered_map<FlowKey, packet_list_t> flowMap;
-    std::unordered_map<FlowKey, uint64_t> lastSeen;
-    std::jthread thread;
+  /**
+   * 一个 shard 的全部状态, 由 shard 线程绑核后自己分配(NUMA first-touch)。
+   * 读线程会写的字段与 shard 私有字段分处不同缓存行, 相邻 shard 也不共享缓存行。
+   */
+  struct alignas(CACHE_LINE) FlowShard {
+    size_t id{};
+    // 读线程发布数据后、文件结束、退出时唤醒
+    moodycamel::LightweightSemaphore wake;
+    // shard 即将阻塞时置位, 读线程据此决定是否需要 signal
+    alignas(CACHE_LINE) std::atomic<bool> sleeping{ false };
+    // 文件读取结束的通知, 值为 FlowKey::source
+    moodycamel::ConcurrentQueue<uint16_t> eofQueue;
+    /// 流和墓碑, lastSeen 的时钟见 mWallClock
+    alignas(CACHE_LINE) FlowTable flows{ INITIAL_FLOWS };
+    /// 按文件记录已见到的最大包时间戳(µs), 不同文件的抓包时间互不相干
+    std::unordered_map<uint16_t, uint64_t> watermark;
+    /// 按文件、读线程记录已确认取完的包时间(µs), 空闲超时只推进到其中最小值
+    std::unordered_map<uint16_t, std::vector<uint64_t>> progress;
+    /// 按文件缓存的读线程数, 新流据此设置 FlowEntry::shared
+    std::unordered_map<uint16_t, size_t> readers;
+    /// 按文件的空闲超时时间轮, 每条流(含墓碑)登记一次
+    std::unordered_map<uint16_t, TimerWheel> timers;
+    /// 落在墓碑上被丢弃的包数
+    uint64_t skipped{ 0 };
+    /// 超出内存预算时删除的墓碑数, 这些流之后的包会成为新流
+    uint64_t dropped{ 0 };
+    /// 负载统计, 用于检查 shard 间是否倾斜
+    uint64_t packets{ 0 };
+    uint64_t flowCount{ 0 };
+    /// 折叠进编码器的包数, 每 FOLD_SAMPLE 个计时一次
+    uint64_t folded{ 0 };
+    /// 各输出格式抽样折叠的耗时(ns), 退出后放大汇总到 mFormatStats
+    std::vector<uint64_t> foldNs;
   };
 
-  static constexpr int SHARD_COUNT = 16;
-  std::array<FlowShard, SHARD_COUNT> mShards;
+  static constexpr size_t DEFAULT_SHARDS = 16;
+  static constexpr size_t DEFAULT_WRITERS = 4;
+  // 每个 shard 流表的初始容量
+  static constexpr size_t INITIAL_FLOWS = 1 << 12;
+  static constexpr size_t MIN_CHUNK_BYTES = 64ull << 20;
+  // shard 一次批量出队的包数
+  static constexpr size_t DRAIN_BATCH = 256;
+  // 折叠耗时的抽样间隔(包), 逐包计时的开销与折叠本身相当
+  static constexpr uint64_t FOLD_SAMPLE = 64;
+  // 超时扫描间隔, 同时是阻塞等待的最长时间
+  static constexpr auto EXPIRY_SCAN_INTERVAL = std::chrono::milliseconds{ 100 };
+  /// 解析后的绑核配置, 先于 shard 数和写线程数初始化
+  std::vector<unsigned> mReaderCpus;
+  std::vector<unsigned> mShardCpus;
+  std::vector<unsigned> mWriterCpus;
+  /// shard 数和写线程数, 构造后不变
+  size_t mShardCount;
+  size_t mWriterCount;
+  /// 所有 shard 分配完状态后就绪, 构造函数等它再返回
+  std::latch mShardsReady;
+  std::vector<std::unique_ptr<FlowShard>> mShards;
+  std::vector<std::jthread> mShardThreads;
+  /// 输出格式列表, 一次读取同时生成所有格式
+  std::vector<std::string> mFormats;
+  /// 所有输出格式的输入需求之并
+  CaptureSpec mCapture;
+  /// 各输出格式的流式编码器; 有格式不支持时为空, shard 缓存包、写出时整体编码
+  std::vector<encoder_factory_t> mEncoders;
+  /// 每个输出格式的耗时(ns): shard 折叠、写出时编码、写文件
+  struct FormatStats {
+    std::atomic<uint64_t> flows{ 0 };
+    std::atomic<uint64_t> foldNs{ 0 };
+    std::atomic<uint64_t> encodeNs{ 0 };
+    std::atomic<uint64_t> writeNs{ 0 };
+  };
+  std::unique_ptr<FormatStats[]> mFormatStats;
+  /// 空闲超时按墙钟判断(实时抓包), 否则按包时间水位
+  bool mWallClock{ false };
+  /// 读线程统计: 通过过滤的包的原始字节数、实际保存的字节数
+  std::atomic<uint64_t> mIngestBytes{ 0 };
+  std::atomic<uint64_t> mStoredBytes{ 0 };
+  /// 大流只计数未分发的包数、改派到其他 shard 的新流数
+  std::atomic<uint64_t> mCountedOnly{ 0 };
+  std::atomic<uint64_t> mRebalanced{ 0 };
 
-  moodycamel::ConcurrentQueue<flow_node_t> mWriteQueue;
+  /// 编码任务: 缓存的包或已折叠好的编码器状态, 二者取其一
+  struct EncodeTask {
+    FlowKey key{};
+    /// 段首包的时间(µs), 区分同一五元组的多段输出
+    int64_t start{};
+    packet_list_t packets{};
+    std::vector<std::unique_ptr<FlowEncoder>> encoders{};
+  };
+  /**
+   * 编码任务(待写出的流), 每个 shard 提交到自己的队列。
+   * 写线程和空闲的 shard 都从中取任务, 自己的队列空了就偷别的。
+   */
+  WorkStealingPool<EncodeTask> mEncodeTasks;
+  // 所有 shard 退出后置位, 写线程取空队列后退出
+  std::atomic<bool> mWriteClosed{ false };
   std::vector<std::jthread> mWriterThreads;
-  static constexpr int WRITER_THREAD_COUNT = 4;
+  // 一条流(或墓碑)在流表中的开销估算, 含负载因子留空
+  static constexpr int64_t FLOW_OVERHEAD = sizeof(FlowEntry) * 8 / 7 + 2;
+  // 每次驱逐 shard 中流数的 1/EVICT_DIVISOR
+  static constexpr size_t EVICT_DIVISOR = 8;
+  // 写队列积压超过 写线程数 * 该值 时不再提前写出流, 写出去也要等写线程才能释放
+  static constexpr size_t EVICT_PENDING_PER_WRITER = 64;
+
+  /// 每个输入文件的输出位置
+  struct FileContext {
+    /// 相对于每个格式输出目录的子目录(批量模式下的 label)
+    std::filesystem::path label;
+    std::string prefix;
+  };
+  /// 读一个文件的一个读线程, shard 据此判断它的进度
+  struct ReaderSlot {
+    static constexpr size_t NO_LANE = SIZE_MAX;
+    /// 所用 lane, 读线程开始前为 NO_LANE
+    std::atomic<size_t> lane{ NO_LANE };
+    /// 读完后置位, 之后 lane 可能被其他文件复用, 只能看 tails
+    std::atomic<bool> done{ false };
+    /// 读完时通往各 shard 的环的已发布位置
+    std::vector<size_t> tails;
+  };
+  /// 正在处理的文件, 以 FlowKey::source 索引
+  struct FileJob {
+    std::filesystem::path input;
+    FileContext context;
+    std::promise<void> done;
+    /// 尚未 flush 的 shard 数 + 已入写队列但未写出的流数, 归零即完成
+    std::atomic<int64_t> pending{ 0 };
+    std::atomic<uint64_t> flows{ 0 };
+    /// 读线程开始前登记, readerCount 为 0 表示还没登记
+    std::unique_ptr<ReaderSlot[]> readers;
+    std::atomic<size_t> readerCount{ 0 };
+  };
+  std::unordered_map<uint16_t, std::shared_ptr<FileJob>> mJobs;
+  std::shared_mutex mJobsMutex;
+  /// 文件完成后归还的 FlowKey::source, 与 mJobs 同受 mJobsMutex 保护;
+  /// 没有可复用的才取 mNextSource, 全部在用时等有文件完成
+  std::vector<uint16_t> mFreeSources;
+  uint32_t mNextSource{ 0 };
+  std::condition_variable_any mSourceCv;
+
+  /// 每个 (读线程, shard) 一条 SPSC 环
+  static constexpr size_t RING_CAPACITY = 2048;
+  using packet_ring_t                   = SpscRing<raw_packet_t, RING_CAPACITY>;
+  /// 一个读线程通往所有 shard 的环, 读线程独占使用, 用完归还复用
+  struct ReaderLane {
+    /// 由首个使用它的读线程分配, 环槽位落在生产者的 NUMA 节点
+    explicit ReaderLane(size_t shards)
+        : rings{ std::make_unique<packet_ring_t[]>(shards) }
+        , progress{ std::make_unique<std::atomic<uint64_t>[]>(shards) } {}
+    std::unique_ptr<packet_ring_t[]> rings;
+    /// 每条环发布时写入当前包的时间(µs), 之后发往该环的包不会更早
+    std::unique_ptr<std::atomic<uint64_t>[]> progress;
+  };
+  static constexpr size_t MAX_LANES = 256;
+  std::array<std::unique_ptr<ReaderLane>, MAX_LANES> mLanes;
+  // shard 只遍历 [0, mLaneCount), lane 只增不减
+  std::atomic<size_t> mLaneCount{ 0 };
+  std::vector<size_t> mFreeLanes;
+  std::mutex mLaneMutex;
+  std::condition_variable mLaneCv;
+
+  static constexpr size_t DISPATCH_BATCH = 64;
+  // 草图估计超过该包数的流按大流精确跟踪
+  static constexpr uint32_t HEAVY_THRESHOLD = 256;
+  // 每个读线程最多精确跟踪的大流数
+  static constexpr size_t MAX_HEAVY_FLOWS = 1024;
+  // 大流只计数的包攒到该值就汇总交给 shard
+  static constexpr uint32_t TALLY_PACKETS = 256;
+  // 环中积压超过该值视为 shard 过载, 新流改派到较空的 shard
+  static constexpr size_t HOT_RING_DEPTH = RING_CAPACITY / 2;
+  // 每个读线程最多记录的改派流数
+  static constexpr size_t MAX_ROUTES = 1 << 16;
+  // 每读这么多包, 把没有待发布包的环的进度推进到当前包
+  static constexpr uint64_t PROGRESS_INTERVAL = 4096;
+  /**
+   * 读线程本地的分发器: 独占一个 ReaderLane 和一个 PacketArena,
+   * 每个 shard 攒满一批才发布, 析构时发布余量并归还 lane。
+   * 大流在编码所需的包都已发出后只计数不再分发, 计数定期汇总给 shard;
+   * 独占一个文件时, 新流在默认 shard 过载时改派。
+   */
+  class DispatchBuffer {
+  public:
+    /// @param reader 在该文件 FileJob::readers 中的下标
+    /// @param exclusive 是否是该文件唯一的读线程, 只有这时才能改派新流
+    /// @param pin 是否按读线程绑核配置绑定当前线程, 只用于解析器自己的线程
+    DispatchBuffer(PcapParser& parser, uint16_t source, size_t reader,
+                   bool exclusive, bool pin);
+    ~DispatchBuffer();
+    void Push(const pcap_pkthdr* pkthdr, const u_char* packet);
+    void Flush();
+
+  private:
+    struct HeavyFlow {
+      /// 最后一个包的时间(µs), 时钟与 shard 的 lastSeen 一致
+      uint64_t last{};
+      /// 上次汇总给 shard 的时间, 时钟同 last
+      uint64_t reported{};
+      /// 识别为大流后发往 shard 的包数
+      uint64_t forwarded{};
+      /// 只计数、还没汇总给 shard 的包数和原始字节数
+      uint32_t packets{};
+      uint32_t bytes{};
+      /// 最后一个包的包时间(µs), 用于汇总的时间戳和清理
+      uint64_t arrive{};
+    };
+    struct Route {
+      size_t shard{};
+      uint64_t last{};
+    };
+
+    /// 大流且编码所需的包已发出时只计数, 返回 true 表示不用再分发
+    bool CountHeavy(FlowKey const& key, uint64_t hash, uint64_t now,
+                    uint32_t wire_len);
+    /// 选 shard: 默认按散列, 已改派的流沿用改派结果
+    size_t PickShard(FlowKey const& key, uint64_t hash, uint64_t now);
+    /// 清理已空闲超过一代的改派记录
+    void PruneRoutes();
+    /// 把大流未汇总的计数作为计数包发给它所在的 shard
+    void SendTally(FlowKey const& key, uint64_t hash, HeavyFlow& heavy);
+    /// 汇总并清理已空闲超过一代的大流, now 为包时间
+    void PruneHeavy(uint64_t now);
+    /// 包写入 shard 的环, 攒够一批才发布
+    void Dispatch(size_t shard_id, raw_packet_t&& raw);
+    /// 发布一条环并更新它的进度
+    void Publish(size_t shard_id);
 
-  std::filesystem::path mInputFile, mParentDir, mOutputDir;
-  pcap_t* mHandle = nullptr;
+    PcapParser& mParser;
+    uint16_t mSource;
+    ReaderSlot& mSlot;
+    bool mExclusive;
+    size_t mLaneId;
+    ReaderLane& mLane;
+    /// 正在分发的包的时间(µs)和已读的包数
+    uint64_t mArrive{ 0 };
+    uint64_t mPushed{ 0 };
+    PacketArena mArena;
+    uint64_t mIngestBytes{ 0 };
+    uint64_t mStoredBytes{ 0 };
+    FlowSketch mSketch;
+    std::unordered_map<FlowKey, HeavyFlow> mHeavy;
+    /// mHeavy 的清理周期(µs, 包时间), 0 表示有协议不按空闲结束, 不清理
+    uint64_t mHeavyWindow;
+    uint64_t mHeavyGeneration{ 0 };
+    uint64_t mCountedOnly{ 0 };
+    SeenFilter mSeen;
+    uint64_t mRoutesGeneration{ 0 };
+    std::unordered_map<FlowKey, Route> mRoutes;
+    /// 按默认 shard 统计的改派流数, 为 0 时不必查 mRoutes
+    std::vector<size_t> mRedirected;
+    uint64_t mRebalanced{ 0 };
+  };
+
+  /// pcap_loop 回调的 user_data
+  struct LoopContext {
+    DispatchBuffer buffer;
+    uint64_t count;
+  };
 
 private:
+  std::future<void> ParseFile(std::filesystem::path const& pcap_file,
+                              FileContext context, size_t readers);
+  std::shared_ptr<FileJob> FindJob(uint16_t source);
+  /// 分配一个不在用的 source 并登记文件
+  uint16_t AddJob(std::shared_ptr<FileJob> job);
+  /// 流的缓存内容作为编码任务提交到 shard 的队列, 计入所属文件
+  void EmitFlow(FlowShard const& shard, FlowEntry& entry);
+  /// 流已超时但表项还在: 写出缓存的内容, 表项原地重置为新流
+  void RestartEntry(FlowShard& shard, FlowEntry& entry);
+  /// 表项即将删除: 还在缓存的流写出, 归还表项的内存预算
+  void RetireEntry(FlowShard const& shard, FlowEntry& entry);
+  /// 取一个编码任务执行, 没有任务时返回 false
+  bool RunEncodeTask(size_t home);
+  /// 所属文件的 pending 减一, 归零时完成该文件
+  void ReleaseJob(uint16_t source);
+  /// 在分发任何包之前登记该文件的读线程数
+  void RegisterReaders(uint16_t source, size_t count);
+  /// 文件是否由多个读线程分段读取
+  bool SharedSource(FlowShard& shard, uint16_t source);
+  /// 收到文件结束通知, flush 本 shard 中该文件剩余的流
+  void FlushSource(FlowShard& shard, uint16_t source);
+  /// @param pin 同时把当前线程绑到 lane 对应的核上
+  size_t AcquireLane(bool pin);
+  void ReleaseLane(size_t lane);
+  /// shard 可能在睡眠时由读线程调用
+  static void Notify(FlowShard& shard);
+  /// 每条环取一批, 返回取到的包数
+  size_t PollPackets(FlowShard& shard);
+  /// 取空所有环
+  void DrainPackets(FlowShard& shard);
+  /// 只取到调用时各环已发布的位置, 之后写入的不等
+  void DrainPublished(FlowShard& shard);
+  [[nodiscard]] bool HasPackets(FlowShard const& shard) const;
+  void AddPacket(FlowShard& shard, raw_packet_t&& pkt);
+  /// 结束空闲超时的流和墓碑
+  void ExpireFlows(FlowShard& shard);
+  /**
+   * 文件在本 shard 的低水位(µs): 还在读的各读线程已确认取完的包时间的最小值,
+   * 之后到达的包都不早于它。有读线程还没开始时为 0, 都读完且取完时取最大包时间。
+   */
+  uint64_t LowWatermark(FlowShard& shard, uint16_t source);
+  /// 按协议取超时配置, 单位 µs
+  static uint64_t IdleTimeout(uint8_t protocol);
+  static int64_t ActiveTimeout(uint8_t protocol);
+  /// 超出内存预算时提前写出本 shard 最久未活动的一部分流, 或删除其中的墓碑
+  void EvictFlows(FlowShard& shard);
+  /// 经 libpcap pcap_loop 读取, 返回通过过滤的包数
+  uint64_t ReadWithLibpcap(std::filesystem::path const& pcap_file,
+                           uint16_t source);
+  /// 经内存映射读取, 不是经典 pcap 时返回 std::nullopt
+  std::optional<uint64_t> ReadWithMmap(std::filesystem::path const& pcap_file,
+                                       uint16_t source, size_t readers);
+  /// 单文件并发读取的线程数, 0 表示按CPU核数自动决定
+  static size_t ReaderCount();
+  /// 批量模式下同时处理的文件数, 0 表示按CPU核数自动决定
+  static size_t JobCount();
+  /// shard 数和写线程数, 0 表示按绑核列表或默认值决定
+  [[nodiscard]] size_t ShardCount() const;
+  [[nodiscard]] size_t WriterCount() const;
+  /// 按输出格式取编码器声明的输入需求, 未知格式返回 std::nullopt
+  static std::optional<CaptureSpec> CaptureFor(std::string const& fmt);
+  static encoder_factory_t EncoderFor(std::string const& fmt);
+  /// 格式列表以逗号分隔, 去掉空项和重复项
+  static std::vector<std::string> SplitFormats(std::string const& formats);
   static uint64_t GetTimestampUs();
-  void RunShard(int shardId, const std::stop_token& stop);
-  void RunWriter(const std::stop_token& stop);
-  void static WriteSession(const flow_node_t& node);
+  void RunShard(size_t shardId, const std::stop_token& stop);
+  void RunWriter(size_t writerId);
+  void WriteFlow(EncodeTask& task);
+  /// 缓存了整条流的包时按输出格式整体编码
+  static cv::Mat Render(std::string const& fmt, packet_list_t const& packets);
+  /// 格式的输出目录: 只有一个格式时为 outdir, 多个格式时各自一棵 outdir/<格式>
+  [[nodiscard]] std::filesystem::path FormatDir(
+    std::filesystem::path const& label, size_t format) const;
+  void WriteSession(FlowKey const& key, int64_t start, size_t format,
+                    cv::Mat const& mat);
 };
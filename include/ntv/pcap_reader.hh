@@ -0,0 +1,143 @@
+//
+// Created by corgi on 2025 四月 20.
+//
+
+#ifndef PCAP_READER_HH
+#define PCAP_READER_HH
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <string>
+#include <vector>
+
+#include <pcap/pcap.h>
+
+/**
+ * 基于内存映射的经典 pcap 读取器。
+ * 支持微秒/纳秒两种 magic 以及大小端字节序，记录头原地解析，
+ * 数据指针直接指向映射区域，读取过程中没有逐包的系统调用和拷贝。
+ * @note pcapng 不支持，IsOpen() 返回 false 时调用方应回退到 libpcap。
+ */
+class PcapReader {
+public:
+  explicit PcapReader(std::filesystem::path const& pcap_file);
+  ~PcapReader();
+
+  PcapReader(PcapReader const&)            = delete;
+  PcapReader& operator=(PcapReader const&) = delete;
+
+  [[nodiscard]] bool IsOpen() const { return mBase != nullptr; }
+  [[nodiscard]] std::string const& Error() const { return mError; }
+  [[nodiscard]] int LinkType() const { return mLinkType; }
+  [[nodiscard]] uint32_t SnapLen() const { return mSnapLen; }
+  /// 第一条记录的偏移(文件头之后)
+  [[nodiscard]] static constexpr size_t DataBegin() { return FILE_HEADER_SIZE; }
+  [[nodiscard]] size_t Size() const { return mSize; }
+
+  /// 编译 BPF 过滤表达式, 之后 Walk 只回调匹配的包
+  bool SetFilter(std::string const& expr);
+
+  /**
+   * 从任意偏移重新找到记录边界。pcap 没有同步标记,
+   * 所以逐字节尝试, 要求该位置及其后连续若干条记录头都合理。
+   * @return [offset, end) 内第一条可信记录的偏移, 找不到返回 end
+   */
+  [[nodiscard]] size_t Resync(size_t offset, size_t end) const;
+
+  /**
+   * 把数据区切成至多 parts 段, 每段起点都经过 Resync 对齐到记录边界
+   * @return 各段起点, 末尾追加 Size() 作为最后一段的终点
+   */
+  [[nodiscard]] std::vector<size_t> Split(size_t parts) const;
+
+  struct WalkResult {
+    /// 通过过滤的包数
+    uint64_t records{};
+    /// 停下的偏移, 正常结束时是第一条起点不小于 end 的记录, 即下一段的起点
+    size_t stop{};
+    /// 遇到不合理的记录头后重新对齐的次数, 以及因此跳过的字节数
+    uint32_t resyncs{};
+    size_t skipped{};
+  };
+
+  /**
+   * 遍历起始偏移位于 [begin, end) 内的所有记录。
+   * 每条记录头都检查一次, 不合理时经 Resync 跳到下一个可信的记录边界继续,
+   * 错位的数据不会当作包交给 fn。路径只取决于 begin, 同一起点走两次结果相同。
+   * @param begin 必须是一条记录的起始偏移
+   * @param end   超过 end 的记录不处理(最后一条可以跨过 end)
+   * @param fn    void(pcap_pkthdr const*, u_char const*)
+   */
+  template <typename Fn>
+  WalkResult Walk(size_t begin, size_t end, Fn&& fn) const {
+    return WalkRecords<true>(begin, end, fn);
+  }
+  /// 与 Walk 走同样的路径但只读记录头, 不过滤也不回调, 返回停下的偏移
+  [[nodiscard]] size_t Follow(size_t const begin, size_t const end) const {
+    return WalkRecords<false>(begin, end, [](pcap_pkthdr const*,
+                                             u_char const*) {})
+      .stop;
+  }
+
+private:
+  static constexpr size_t FILE_HEADER_SIZE   = 24;
+  static constexpr size_t RECORD_HEADER_SIZE = 16;
+
+  template <bool Deliver, typename Fn>
+  WalkResult WalkRecords(size_t begin, size_t end, Fn&& fn) const;
+  void Close();
+  [[nodiscard]] uint32_t Load32(u_char const* p) const;
+  /// 解析 offset 处的记录头, 越界或末尾记录被截断返回 false
+  bool ReadHeader(size_t offset, pcap_pkthdr& hdr) const;
+  /// 长度和微秒字段在合法范围内, Walk 逐条检查
+  [[nodiscard]] static bool WellFormed(pcap_pkthdr const& hdr);
+  /// 记录头字段是否合理(不检查前后记录), 比 WellFormed 更严, 用于 Resync
+  [[nodiscard]] bool Plausible(pcap_pkthdr const& hdr) const;
+
+  u_char const* mBase = nullptr;
+  size_t mSize        = 0;
+  bool mSwapped       = false;
+  bool mNanosecond    = false;
+  int mLinkType       = DLT_EN10MB;
+  uint32_t mSnapLen   = 0;
+  uint32_t mFirstTs   = 0;
+  bool mHasFilter     = false;
+  bpf_program mProgram{};
+  std::string mError{};
+#ifdef _WIN32
+  void* mFileHandle    = nullptr;
+  void* mMappingHandle = nullptr;
+#endif
+};
+
+template <bool Deliver, typename Fn>
+PcapReader::WalkResult PcapReader::WalkRecords(size_t const begin,
+                                               size_t const end,
+                                               Fn&& fn) const {
+  WalkResult result{ .stop = begin };
+  pcap_pkthdr hdr{};
+  while (result.stop < end) {
+    if (not ReadHeader(result.stop, hdr)) break;
+    // 切分点是 Resync 推测的, 之后的记录头也不能默认可信
+    if (not WellFormed(hdr)) {
+      size_t const resume{ Resync(result.stop + 1, end) };
+      ++result.resyncs;
+      result.skipped += resume - result.stop;
+      result.stop = resume;
+      continue;
+    }
+    u_char const* data{ mBase + result.stop + RECORD_HEADER_SIZE };
+    result.stop += RECORD_HEADER_SIZE + hdr.caplen;
+    if constexpr (Deliver) {
+      if (mHasFilter and pcap_offline_filter(&mProgram, &hdr, data) == 0) {
+        continue;
+      }
+      ++result.records;
+      fn(&hdr, data);
+    }
+  }
+  return result;
+}
+
+#endif // PCAP_READER_HH
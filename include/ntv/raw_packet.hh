@@ -5,8 +5,11 @@
 #ifndef RAW_PACKET_INFO_HPP
 #define RAW_PACKET_INFO_HPP
 
+#include <atomic>
 #include <memory>
+#include <optional>
 #include <string>
+#include <utility>
 
 #ifdef WIN32
 #include <ntv/missing.hh>
@@ -22,17 +25,55 @@
 #include <ntv/flow_key.hh>
 #include <ntv/aligned_packet.hh>
 
+struct PacketSlab;
+
+/**
+ * 入口处解析一次得到的包描述, 随包传递, shard 和编码器不再重复解析头部。
+ * 偏移均相对于帧起始。
+ */
+struct PacketMeta {
+  /// 规范化后的五元组(小的IP+port在前)
+  FlowKey key{};
+  uint16_t l2{};
+  uint16_t l3{};
+  uint16_t l4{};
+  uint16_t payload{};
+  /// 已捕获的负载字节数
+  uint16_t payloadLen{};
+  /// 0: 源地址即 key.ip1/port1, 1: 规范化时做过交换
+  uint8_t direction{};
+
+  /**
+   * 解析以太网(可带一层 VLAN) + IPv4 + TCP/UDP 头部
+   * @param source 所属文件编号, 写入 key.source
+   * @return 非 IPv4 TCP/UDP 或头部被截断时返回 std::nullopt
+   */
+  static std::optional<PacketMeta> Decode(u_char const* data, uint32_t caplen,
+                                          uint16_t source);
+};
+
+/**
+ * 抓到的一个包。由 PacketArena 在 slab 中就地构造, 字节数据紧跟在对象之后,
+ * 生命周期由所在 slab 的引用计数管理, 不单独析构。
+ */
 struct RawPacket {
-  RawPacket() = default;
+  /// 原始的时间戳、caplen 和 len, 截断保存时也不改
   pcap_pkthdr info_hdr{};
-  ustring_t byte_arr{};
+  PacketMeta meta{};
+  /// 实际保存的字节数, 见 CaptureSpec; 0 表示计数包, 见 IsTally
+  uint32_t length{};
+  /// 所在 slab
+  PacketSlab* slab{};
   /**
    * raw packet 构造函数
    * @param pkthdr meta data
    * @param packet packet data
-   * @note 会将meta信息和packet所有的字节复制一份。
+   * @param meta   PacketMeta::Decode 的结果
+   * @param length 保存的字节数, 不超过 caplen
+   * @note 会将meta信息和packet的前 length 字节复制到对象之后, 调用方需预留空间。
    */
-  RawPacket(pcap_pkthdr const* pkthdr, u_char const* packet);
+  RawPacket(pcap_pkthdr const* pkthdr, u_char const* packet,
+            PacketMeta const& meta, uint32_t length, PacketSlab* slab);
 
   RawPacket(RawPacket const& other)                = delete;
   RawPacket(RawPacket&& other) noexcept            = delete;
@@ -40,19 +81,79 @@ struct RawPacket {
   RawPacket& operator=(RawPacket&& other) noexcept = delete;
 
   [[nodiscard]] auto ArriveTime() const -> std::int64_t;
+  /// 保存的字节数
   [[nodiscard]] auto ByteCount() const -> std::int64_t;
   /// 字节数据的开始地址
-  /// @return const_iterator
   [[nodiscard]] auto Data() const -> u_char const*;
   /// 字节数据的开始地址
-  /// @return const_iterator
-  [[nodiscard]] auto Beg() const -> ustring_t::const_iterator;
+  [[nodiscard]] auto Beg() const -> u_char const*;
   /// 字节数据的末尾
-  /// @return const_iterator
-  [[nodiscard]] auto End() const -> ustring_t::const_iterator;
-  [[nodiscard]] std::optional<FlowKey> GetFlowKey() const;
-  [[nodiscard]] std::optional<AlignedPacket> ToAligned() const;
+  [[nodiscard]] auto End() const -> u_char const*;
+  [[nodiscard]] FlowKey const& Key() const { return meta.key; }
+  /**
+   * 读线程汇总的大流计数, 不是真实的包: info_hdr.caplen 为包数,
+   * info_hdr.len 为原始字节数, 时间戳为其中最后一个包的时间。
+   * 真实的包至少保存以太网头, length 不会为 0。
+   */
+  [[nodiscard]] bool IsTally() const { return length == 0; }
+  /// 按 meta 中的偏移排列成固定布局, 不再解析头部
+  [[nodiscard]] AlignedPacket ToAligned() const;
+
+};
+
+/// 一块连续存放 RawPacket 的内存, 头部之后依次是各个包
+struct PacketSlab {
+  /// 存活的包引用数, 见 PacketArena 的偏置计数
+  std::atomic<int64_t> refs{ 0 };
+  /// 整块字节数(含头部)
+  uint32_t capacity{};
+  /// 计入 global::memory 的字节数, 释放时归还
+  uint32_t charged{};
+};
+
+/// 引用归零时回收整块 slab, 定义见 packet_arena.cc
+void ReleaseSlab(PacketSlab* slab);
+
+/**
+ * 包句柄: 一个指针大小, 拷贝/析构只增减所在 slab 的计数。
+ * slab 中最后一个包被释放时整块回收。
+ */
+class PacketRef {
+public:
+  PacketRef() = default;
+  PacketRef(std::nullptr_t) {}
+  /// 接管一个已计入 slab 引用的包, 由 PacketArena 调用
+  explicit PacketRef(RawPacket* packet) : mPacket{ packet } {}
+  PacketRef(PacketRef const& other) : mPacket{ other.mPacket } {
+    if (mPacket) mPacket->slab->refs.fetch_add(1, std::memory_order_relaxed);
+  }
+  PacketRef(PacketRef&& other) noexcept
+      : mPacket{ std::exchange(other.mPacket, nullptr) } {}
+  PacketRef& operator=(PacketRef other) noexcept {
+    std::swap(mPacket, other.mPacket);
+    return *this;
+  }
+  ~PacketRef() { Reset(); }
+
+  void Reset() {
+    if (mPacket == nullptr) return;
+    PacketSlab* const slab{ mPacket->slab };
+    mPacket = nullptr;
+    if (slab->refs.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+      ReleaseSlab(slab);
+    }
+  }
+
+  [[nodiscard]] RawPacket* get() const { return mPacket; }
+  RawPacket* operator->() const { return mPacket; }
+  RawPacket& operator*() const { return *mPacket; }
+  explicit operator bool() const { return mPacket != nullptr; }
+  friend bool operator==(PacketRef const& ref, std::nullptr_t) {
+    return ref.mPacket == nullptr;
+  }
 
+private:
+  RawPacket* mPacket{ nullptr };
 };
 
 struct Peer {
@@ -0,0 +1,91 @@
+//
+// Created by corgi on 2025 四月 22.
+//
+
+#ifndef SPSC_RING_HH
+#define SPSC_RING_HH
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstddef>
+
+inline constexpr size_t CACHE_LINE = 64;
+
+/**
+ * 定长单生产者/单消费者环形队列。
+ * 生产者 TryPush 只写本地尾指针, Publish 时才对消费者可见,
+ * 一次发布一批以减少共享缓存行的写; 消费者 PopBulk 同理一批更新一次头指针。
+ * 两端各自缓存对端的指针, 只有看起来满/空时才去读共享的那条缓存行。
+ * @tparam Capacity 必须是 2 的幂
+ */
+template <typename T, size_t Capacity>
+class SpscRing {
+  static_assert((Capacity & (Capacity - 1)) == 0, "Capacity 必须是 2 的幂");
+
+public:
+  // === 生产者 ===
+  /// 满时返回 false 且不移动 value
+  bool TryPush(T&& value) {
+    if (mLocalTail - mCachedHead == Capacity) {
+      mCachedHead = mHead.load(std::memory_order_acquire);
+      if (mLocalTail - mCachedHead == Capacity) return false;
+    }
+    mSlots[mLocalTail & MASK] = std::move(value);
+    ++mLocalTail;
+    return true;
+  }
+  /// 发布 TryPush 写入的所有元素
+  void Publish() { mTail.store(mLocalTail, std::memory_order_release); }
+  /// 已写入但未发布的元素数
+  [[nodiscard]] size_t Unpublished() const {
+    return mLocalTail - mTail.load(std::memory_order_relaxed);
+  }
+
+  // === 消费者 ===
+  /// 取出至多 max 个已发布的元素, 返回实际个数
+  template <typename It>
+  size_t PopBulk(It out, size_t const max) {
+    size_t const head{ mHead.load(std::memory_order_relaxed) };
+    if (mCachedTail == head) {
+      mCachedTail = mTail.load(std::memory_order_acquire);
+      if (mCachedTail == head) return 0;
+    }
+    size_t const n{ (std::min)(max, mCachedTail - head) };
+    for (size_t i = 0; i < n; ++i) {
+      *out++ = std::move(mSlots[(head + i) & MASK]);
+    }
+    mHead.store(head + n, std::memory_order_release);
+    return n;
+  }
+  [[nodiscard]] bool Empty() const {
+    return mTail.load(std::memory_order_acquire) ==
+      mHead.load(std::memory_order_relaxed);
+  }
+  /// 已发布未取走的元素数(近似)
+  [[nodiscard]] size_t SizeApprox() const {
+    return mTail.load(std::memory_order_relaxed) -
+      mHead.load(std::memory_order_relaxed);
+  }
+  /// 已发布和已取走的位置, 都只增不减; 消费者据此只取到某一时刻为止
+  [[nodiscard]] size_t Published() const {
+    return mTail.load(std::memory_order_acquire);
+  }
+  [[nodiscard]] size_t Consumed() const {
+    return mHead.load(std::memory_order_relaxed);
+  }
+
+private:
+  static constexpr size_t MASK = Capacity - 1;
+
+  // 消费者写, 生产者偶尔读
+  alignas(CACHE_LINE) std::atomic<size_t> mHead{ 0 };
+  size_t mCachedTail{ 0 };
+  // 生产者写, 消费者偶尔读
+  alignas(CACHE_LINE) std::atomic<size_t> mTail{ 0 };
+  size_t mLocalTail{ 0 };
+  size_t mCachedHead{ 0 };
+  alignas(CACHE_LINE) std::array<T, Capacity> mSlots{};
+};
+
+#endif // SPSC_RING_HH
@@ -0,0 +1,88 @@
+//
+// Created by corgi on 2025 四月 26.
+//
+
+#ifndef TIMER_WHEEL_HH
+#define TIMER_WHEEL_HH
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+#include <ntv/flow_key.hh>
+
+/**
+ * 分层时间轮, 用于流的超时。
+ * 推进时只处理到期槽中的定时器, 开销与到期数成正比, 与流总数无关。
+ * 定时器不支持取消: 到期时由调用方核对流的实际状态, 未超时则重新登记(惰性删除)。
+ * 时间单位为 µs, 由调用方决定时钟(包时间戳或墙钟)。
+ */
+class TimerWheel {
+public:
+  /// 时间轮精度
+  static constexpr uint64_t TICK_US = 10'000;
+
+  explicit TimerWheel(uint64_t now_us);
+
+  /// 登记 key 在 deadline_us 到期, 超出时间轮范围时提前到最远的槽
+  void Schedule(FlowKey const& key, uint64_t deadline_us);
+  /**
+   * 推进到 now_us, 对每个到期的定时器调用 fn(FlowKey const&)。
+   * fn 中可以再次 Schedule。
+   */
+  template <typename Fn>
+  void Advance(uint64_t now_us, Fn&& fn);
+
+  [[nodiscard]] size_t Size() const { return mSize; }
+
+private:
+  static constexpr size_t SLOT_BITS = 6;
+  static constexpr size_t SLOTS     = size_t{ 1 } << SLOT_BITS;
+  static constexpr size_t MASK      = SLOTS - 1;
+  static constexpr size_t LEVELS    = 4;
+  /// 可直接登记的最远 tick 数
+  static constexpr uint64_t RANGE = uint64_t{ 1 } << (SLOT_BITS * LEVELS);
+
+  struct Timer {
+    FlowKey key;
+    uint64_t tick;
+  };
+  using slot_t = std::vector<Timer>;
+
+  void Insert(Timer&& timer);
+  /// 把 level 层当前槽的定时器重新分配到下层
+  void Cascade(size_t level);
+  /// 跨度超出范围时把所有定时器取出重新登记, 避免逐 tick 空转
+  void Rebase(uint64_t tick);
+
+  uint64_t mNow;
+  size_t mSize{ 0 };
+  std::array<std::array<slot_t, SLOTS>, LEVELS> mSlots{};
+};
+
+template <typename Fn>
+void TimerWheel::Advance(uint64_t const now_us, Fn&& fn) {
+  uint64_t const target{ now_us / TICK_US };
+  if (target <= mNow) return;
+  if (mSize == 0 or target - mNow >= RANGE) {
+    Rebase(target - 1);
+  }
+  slot_t fired;
+  while (mNow < target) {
+    ++mNow;
+    if ((mNow & MASK) == 0) Cascade(1);
+    // 交换后槽中留下上一轮的空 vector, 复用其容量
+    std::swap(fired, mSlots[0][mNow & MASK]);
+    mSize -= fired.size();
+    for (auto const& timer : fired) fn(timer.key);
+    fired.clear();
+    if (mSize == 0) {
+      mNow = target;
+      break;
+    }
+  }
+}
+
+#endif // TIMER_WHEEL_HH
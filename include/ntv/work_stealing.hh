@@ -0,0 +1,85 @@
+//
+// Created by corgi on 2025 四月 30.
+//
+
+#ifndef WORK_STEALING_HH
+#define WORK_STEALING_HH
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <memory>
+
+#include <moodycamel/concurrent_queue.hh>
+#include <moodycamel/lightweight_semaphore.hh>
+#include <ntv/spsc_ring.hh>
+
+/**
+ * 任务窃取池: 每个生产者(shard)一条任务队列。
+ * 取任务时先取自己的队列, 空了再按顺序从其他队列偷,
+ * 所以任何空闲线程都能执行任何 shard 提交的任务。
+ * 专职工作线程没有任务时睡眠, 提交任务时只在有人睡眠时唤醒。
+ */
+template <typename Task>
+class WorkStealingPool {
+public:
+  explicit WorkStealingPool(size_t const queues)
+      : mCount{ queues }
+      , mQueues{ std::make_unique<Queue[]>(queues) } {}
+
+  /// 提交到 home 队列
+  void Push(size_t const home, Task&& task) {
+    mQueues[home].tasks.enqueue(std::move(task));
+    // 与 WaitPop 中登记睡眠后复查的顺序配对, 保证不丢唤醒
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (mSleepers.load(std::memory_order_relaxed) > 0) mWake.signal();
+  }
+
+  /// 先取 home 队列, 再从其他队列偷, 都空时返回 false
+  bool TryPop(size_t const home, Task& task) {
+    for (size_t i = 0; i < mCount; ++i) {
+      if (mQueues[(home + i) % mCount].tasks.try_dequeue(task)) return true;
+    }
+    return false;
+  }
+
+  /// 没有任务时最多睡 timeout
+  template <typename Rep, typename Period>
+  bool WaitPop(size_t const home, Task& task,
+               std::chrono::duration<Rep, Period> const timeout) {
+    if (TryPop(home, task)) return true;
+    mSleepers.fetch_add(1);
+    bool got{ TryPop(home, task) };
+    if (not got) {
+      mWake.wait(
+        std::chrono::duration_cast<std::chrono::microseconds>(timeout).count());
+      got = TryPop(home, task);
+    }
+    mSleepers.fetch_sub(1, std::memory_order_relaxed);
+    return got;
+  }
+
+  /// 唤醒最多 count 个睡眠中的线程, 用于退出
+  void WakeAll(size_t const count) {
+    mWake.signal(static_cast<moodycamel::LightweightSemaphore::ssize_t>(count));
+  }
+
+  [[nodiscard]] size_t SizeApprox() const {
+    size_t size{ 0 };
+    for (size_t i = 0; i < mCount; ++i) size += mQueues[i].tasks.size_approx();
+    return size;
+  }
+
+private:
+  // 相邻队列的头尾不共享缓存行
+  struct alignas(CACHE_LINE) Queue {
+    moodycamel::ConcurrentQueue<Task> tasks;
+  };
+
+  size_t mCount;
+  std::unique_ptr<Queue[]> mQueues;
+  alignas(CACHE_LINE) std::atomic<size_t> mSleepers{ 0 };
+  moodycamel::LightweightSemaphore mWake;
+};
+
+#endif // WORK_STEALING_HH
@@ -3,27 +3,130 @@
 #include <ntv/helpers.hh>
 #include <xlog/api.hh>
 
+#include <algorithm>
+#include <charconv>
+
 #include <wintoastlib.h>
 
 namespace fs = std::filesystem;
 
+/// 形如 --name=value 的参数, 名字匹配时返回 value
+static std::optional<std::string_view> OptionValue(std::string_view const arg,
+                                                   std::string_view const name) {
+  if (not arg.starts_with(name) or arg.size() <= name.size() or
+      arg[name.size()] != '=') {
+    return std::nullopt;
+  }
+  return arg.substr(name.size() + 1);
+}
+
+static std::chrono::seconds Seconds(std::string_view const value) {
+  return std::chrono::seconds{ std::stol(std::string{ value }) };
+}
+
+[[noreturn]] static void Usage(char const* program) {
+  XLOG_WARN << "Usage: " << fs::path{ program }.stem().string()
+            << " <output-format:tile|mtf|gaf[,...]> <outdir> <pcapfile|pcapdir>"
+            << " [--reader=mmap|pcap] [--readers=N] [--jobs=N]"
+            << " [--memory=MB] [--clock=packet|wall]"
+            << " [--tcp-idle=S] [--tcp-active=S] [--udp-idle=S]"
+            << " [--udp-active=S] [--hash-seed=N] [--shards=N]"
+            << " [--writers=N] [--reader-cpus=LIST] [--shard-cpus=LIST]"
+            << " [--writer-cpus=LIST] [--gaf-len=N]"
+            << " [--gaf-series=bytes|lengths|intervals] [--gaf-field=gasf|gadf]";
+  exit(EXIT_FAILURE);
+}
+
+/// 整数参数, 不是 [min, max] 内的十进制数时给出用法并退出
+static size_t Number(char const* program, std::string_view const name,
+                     std::string_view const value, size_t const min,
+                     size_t const max) {
+  size_t n{};
+  auto const [end, ec]{ std::from_chars(value.data(),
+                                        value.data() + value.size(), n) };
+  if (ec != std::errc{} or end != value.data() + value.size() or n < min or
+      n > max) {
+    XLOG_ERROR << name << " 应在 [" << min << ", " << max << "] 之间: " << value;
+    Usage(program);
+  }
+  return n;
+}
+
+/// 取值只能是 choices 之一, 否则给出用法并退出
+static std::string_view Choice(char const* program, std::string_view const name,
+                               std::string_view const value,
+                               std::initializer_list<std::string_view> choices) {
+  if (std::ranges::find(choices, value) == choices.end()) {
+    XLOG_ERROR << "未知的 " << name << ": " << value;
+    Usage(program);
+  }
+  return value;
+}
+
 int main(int const argc, char* argv[]) {
   xlog::setLogLevelTo(xlog::Level::INFO);
   xlog::toggleAsyncLogging(TOGGLE_OFF);
   xlog::toggleConsoleLogging(TOGGLE_ON);
-  if (argc < 3) {
-    XLOG_WARN << "Usage: " << fs::path{ argv[0] }.stem().string()
-              << "<output-format:tile|mtf|pcap> <outdir> <pcapfile>";
-    exit(EXIT_FAILURE);
-  }
+  if (argc < 4) Usage(argv[0]);
+  // 线程数的上限, 0 为自动; 内存预算按字节计要放得进 int64_t
+  constexpr size_t max_threads{ 1024 };
+  constexpr size_t max_memory_mb{ size_t{ INT64_MAX } >> 20 };
   global::opt.outfmt = argv[1];
   global::opt.outdir = argv[2];
-  fs::path const pcap_file{ argv[3] };
-  XLOG_INFO << "开始: " << pcap_file.filename().string();
+  fs::path const input{ argv[3] };
+  for (int i = 4; i < argc; ++i) {
+    std::string_view const arg{ argv[i] };
+    if (auto const v{ OptionValue(arg, "--reader") }) {
+      global::opt.reader = Choice(argv[0], "--reader", *v, { "mmap", "pcap" });
+    } else if (auto const v{ OptionValue(arg, "--readers") }) {
+      global::opt.readers = Number(argv[0], "--readers", *v, 0, max_threads);
+    } else if (auto const v{ OptionValue(arg, "--jobs") }) {
+      global::opt.jobs = Number(argv[0], "--jobs", *v, 0, max_threads);
+    } else if (auto const v{ OptionValue(arg, "--memory") }) {
+      global::opt.memoryMB = Number(argv[0], "--memory", *v, 0, max_memory_mb);
+    } else if (auto const v{ OptionValue(arg, "--clock") }) {
+      global::opt.clock = Choice(argv[0], "--clock", *v, { "packet", "wall" });
+    } else if (auto const v{ OptionValue(arg, "--tcp-idle") }) {
+      global::opt.tcp.idle = Seconds(*v);
+    } else if (auto const v{ OptionValue(arg, "--tcp-active") }) {
+      global::opt.tcp.active = Seconds(*v);
+    } else if (auto const v{ OptionValue(arg, "--udp-idle") }) {
+      global::opt.udp.idle = Seconds(*v);
+    } else if (auto const v{ OptionValue(arg, "--udp-active") }) {
+      global::opt.udp.active = Seconds(*v);
+    } else if (auto const v{ OptionValue(arg, "--hash-seed") }) {
+      global::opt.hashSeed = std::stoull(std::string{ *v });
+    } else if (auto const v{ OptionValue(arg, "--shards") }) {
+      global::opt.shards = Number(argv[0], "--shards", *v, 0, max_threads);
+    } else if (auto const v{ OptionValue(arg, "--writers") }) {
+      global::opt.writers = Number(argv[0], "--writers", *v, 0, max_threads);
+    } else if (auto const v{ OptionValue(arg, "--reader-cpus") }) {
+      global::opt.readerCpus = *v;
+    } else if (auto const v{ OptionValue(arg, "--shard-cpus") }) {
+      global::opt.shardCpus = *v;
+    } else if (auto const v{ OptionValue(arg, "--writer-cpus") }) {
+      global::opt.writerCpus = *v;
+    } else if (auto const v{ OptionValue(arg, "--gaf-len") }) {
+      // 图像为 len x len, 像素数要放得进 int; 0 会被当作不限包数
+      global::opt.gafLen =
+        Number(argv[0], "--gaf-len", *v, 1, size_t{ 1 } << 15);
+    } else if (auto const v{ OptionValue(arg, "--gaf-series") }) {
+      global::opt.gafSeries = *v;
+    } else if (auto const v{ OptionValue(arg, "--gaf-field") }) {
+      global::opt.gafField = *v;
+    } else {
+      XLOG_WARN << "忽略未知参数: " << arg;
+    }
+  }
+  XLOG_INFO << "输入: " << input.string();
   XLOG_INFO << "输出: " << global::opt.outfmt;
   {
     PcapParser parser{};
-    parser.ParseFile(pcap_file);
+    if (fs::is_directory(input)) {
+      parser.ParseDirectory(input);
+    } else {
+      parser.ParseFile(input).wait();
+    }
   }
   XLOG_INFO << "完成";
   ShowNotification(
@@ -0,0 +1,88 @@
+//
+// Created by corgi on 2025 四月 29.
+//
+
+#ifdef _WIN32
+#include <windows.h>
+#elif defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+#include <charconv>
+#include <string>
+
+#include <ntv/cpu_affinity.hh>
+#include <xlog/api.hh>
+
+#ifdef _WIN32
+// 只支持第一个处理器组内的 64 个核
+static constexpr unsigned MAX_CPUS = 64;
+#elif defined(__linux__)
+// cpu_set_t 的容量, 更大的编号 CPU_SET 会越界
+static constexpr unsigned MAX_CPUS = CPU_SETSIZE;
+#else
+static constexpr unsigned MAX_CPUS = 1024;
+#endif
+
+static bool ParseCpu(std::string_view const text, unsigned& cpu) {
+  auto const [end, ec]{ std::from_chars(text.data(), text.data() + text.size(),
+                                        cpu) };
+  return ec == std::errc{} and end == text.data() + text.size();
+}
+
+std::vector<unsigned> ParseCpuList(std::string_view list) {
+  std::vector<unsigned> cpus;
+  while (not list.empty()) {
+    size_t const comma{ list.find(',') };
+    std::string_view const item{ list.substr(0, comma) };
+    list = comma == std::string_view::npos ? std::string_view{}
+                                           : list.substr(comma + 1);
+    size_t const dash{ item.find('-') };
+    unsigned first{}, last{};
+    bool const ok{ dash == std::string_view::npos
+                     ? ParseCpu(item, first) and ParseCpu(item, last)
+                     : ParseCpu(item.substr(0, dash), first) and
+                       ParseCpu(item.substr(dash + 1), last) };
+    if (not ok or first > last) {
+      XLOG_WARN << "CPU 列表格式错误, 不绑核: " << std::string{ item };
+      return {};
+    }
+    if (last >= MAX_CPUS) {
+      XLOG_WARN << "CPU 编号超出上限 " << MAX_CPUS - 1
+                << ", 不绑核: " << std::string{ item };
+      return {};
+    }
+    for (unsigned cpu = first; cpu <= last; ++cpu) cpus.push_back(cpu);
+  }
+  return cpus;
+}
+
+bool PinCurrentThread(std::vector<unsigned> const& cpus, size_t const index) {
+  if (cpus.empty()) return false;
+  unsigned const cpu{ cpus[index % cpus.size()] };
+#ifdef _WIN32
+  if (cpu >= MAX_CPUS or
+      SetThreadAffinityMask(GetCurrentThread(), DWORD_PTR{ 1 } << cpu) == 0) {
+    XLOG_WARN << "绑核失败: CPU " << cpu;
+    return false;
+  }
+  return true;
+#elif defined(__linux__)
+  if (cpu >= MAX_CPUS) {
+    XLOG_WARN << "绑核失败: CPU " << cpu;
+    return false;
+  }
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  CPU_SET(cpu, &set);
+  if (pthread_setaffinity_np(pthread_self(), sizeof(set), &set) != 0) {
+    XLOG_WARN << "绑核失败: CPU " << cpu;
+    return false;
+  }
+  return true;
+#else
+  XLOG_WARN << "当前平台不支持绑核";
+  return false;
+#endif
+}
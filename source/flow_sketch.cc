@@ -0,0 +1,61 @@
+//
+// Created by corgi on 2025 四月 28.
+//
+
+#include <algorithm>
+#include <limits>
+
+#include <ntv/flow_sketch.hh>
+
+uint32_t FlowSketch::Add(uint64_t const hash) {
+  if (++mAdded % AGING_PACKETS == 0) Age();
+  uint32_t estimate{ std::numeric_limits<uint32_t>::max() };
+  for (size_t row = 0; row < ROWS; ++row) {
+    size_t const column{ (hash >> (row * WIDTH_BITS)) & (WIDTH - 1) };
+    estimate = (std::min)(estimate, ++mCounters[row][column]);
+  }
+  return estimate;
+}
+
+void FlowSketch::Age() {
+  for (auto& row : mCounters) {
+    for (auto& counter : row) counter >>= 1;
+  }
+}
+
+SeenFilter::SeenFilter(uint64_t const window_us)
+    : mWindow{ window_us }
+    , mCurrent(BITS / 64, 0)
+    , mPrevious(BITS / 64, 0) {}
+
+bool SeenFilter::TestAndSet(uint64_t const hash, uint64_t const now_us) {
+  if (mStart == 0) mStart = now_us;
+  if (mWindow != 0 and now_us >= mStart + mWindow) {
+    // 跳过不止一代时上一代也已过期
+    if (now_us >= mStart + 2 * mWindow) {
+      std::ranges::fill(mCurrent, 0);
+    }
+    std::swap(mPrevious, mCurrent);
+    std::ranges::fill(mCurrent, 0);
+    mStart = now_us;
+  }
+  bool const seen{ Test(mCurrent, hash) or Test(mPrevious, hash) };
+  Set(mCurrent, hash);
+  return seen;
+}
+
+bool SeenFilter::Test(std::vector<uint64_t> const& bits, uint64_t const hash) {
+  for (size_t i = 0; i < HASHES; ++i) {
+    // 与 shard 选择和 FlowSketch 错开, 从高位取
+    size_t const bit{ (hash >> (64 - BITS_LOG * (i + 1))) & (BITS - 1) };
+    if ((bits[bit / 64] >> (bit % 64) & 1) == 0) return false;
+  }
+  return true;
+}
+
+void SeenFilter::Set(std::vector<uint64_t>& bits, uint64_t const hash) {
+  for (size_t i = 0; i < HASHES; ++i) {
+    size_t const bit{ (hash >> (64 - BITS_LOG * (i + 1))) & (BITS - 1) };
+    bits[bit / 64] |= uint64_t{ 1 } << (bit % 64);
+  }
+}
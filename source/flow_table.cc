@@ -0,0 +1,111 @@
+//
+// Created by corgi on 2025 四月 27.
+//
+
+#include <algorithm>
+#include <bit>
+#include <utility>
+
+#include <ntv/flow_table.hh>
+
+FlowTable::FlowTable(size_t const reserve, uint64_t const seed)
+    : mSeed{ seed } {
+  Reserve(reserve);
+}
+
+void FlowTable::Reserve(size_t const flows) {
+  size_t const needed{ (flows * LOAD_DEN + LOAD_NUM - 1) / LOAD_NUM };
+  size_t const capacity{ std::bit_ceil((std::max)(needed, MIN_CAPACITY)) };
+  if (capacity > mSlots.size()) Rehash(capacity);
+}
+
+size_t FlowTable::Home(FlowKey const& key) const {
+  // 低位已用于选 shard, 下标取高位
+  return static_cast<size_t>(HashFlowKey(key, mSeed) >> mShift);
+}
+
+FlowEntry* FlowTable::Find(FlowKey const& key) {
+  if (mSize == 0) return nullptr;
+  size_t index{ Home(key) };
+  for (uint16_t dist = 1;; ++dist) {
+    // Robin Hood 不变式: 遇到更"富"的表项说明 key 不存在
+    if (mDist[index] < dist) return nullptr;
+    if (mDist[index] == dist and mSlots[index].key == key) {
+      return &mSlots[index];
+    }
+    index = (index + 1) & mMask;
+  }
+}
+
+std::pair<FlowEntry*, bool> FlowTable::TryEmplace(FlowKey const& key) {
+  if ((mSize + 1) * LOAD_DEN > mSlots.size() * LOAD_NUM) {
+    Rehash((std::max)(mSlots.size() * 2, MIN_CAPACITY));
+  }
+  size_t index{ Home(key) };
+  uint16_t dist{ 1 };
+  for (;; ++dist) {
+    if (mDist[index] < dist) break;
+    if (mDist[index] == dist and mSlots[index].key == key) {
+      return { &mSlots[index], false };
+    }
+    index = (index + 1) & mMask;
+  }
+
+  // 新表项放在 index, 原来的表项依次向后挤
+  size_t const placed{ index };
+  FlowEntry carry{};
+  carry.key = key;
+  while (mDist[index] != 0) {
+    std::swap(carry, mSlots[index]);
+    std::swap(dist, mDist[index]);
+    index = (index + 1) & mMask;
+    ++dist;
+  }
+  mSlots[index] = std::move(carry);
+  mDist[index]  = dist;
+  ++mSize;
+  return { &mSlots[placed], true };
+}
+
+bool FlowTable::Erase(FlowKey const& key) {
+  FlowEntry const* entry{ Find(key) };
+  if (entry == nullptr) return false;
+  EraseAt(static_cast<size_t>(entry - mSlots.data()));
+  return true;
+}
+
+void FlowTable::EraseAt(size_t index) {
+  for (size_t next = (index + 1) & mMask; mDist[next] > 1;
+       next            = (next + 1) & mMask) {
+    mSlots[index] = std::move(mSlots[next]);
+    mDist[index]  = mDist[next] - 1;
+    index         = next;
+  }
+  mSlots[index] = FlowEntry{};
+  mDist[index]  = 0;
+  --mSize;
+}
+
+void FlowTable::Clear() {
+  for (size_t i = 0; i < mSlots.size(); ++i) {
+    if (mDist[i] == 0) continue;
+    mSlots[i] = FlowEntry{};
+    mDist[i]  = 0;
+  }
+  mSize = 0;
+}
+
+void FlowTable::Rehash(size_t const capacity) {
+  std::vector<FlowEntry> slots(capacity);
+  std::vector<uint16_t> dist(capacity, 0);
+  std::swap(slots, mSlots);
+  std::swap(dist, mDist);
+  mMask  = capacity - 1;
+  mShift = 64 - std::countr_zero(capacity);
+  mSize  = 0;
+  for (size_t i = 0; i < slots.size(); ++i) {
+    if (dist[i] == 0) continue;
+    auto const [entry, inserted]{ TryEmplace(slots[i].key) };
+    *entry = std::move(slots[i]);
+  }
+}
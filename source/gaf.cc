@@ -2,54 +2,200 @@
 // Created by corgi on 2025 四月 02.
 //
 
+#include <algorithm>
 #include <cmath>
 #include <ntv/gaf.hh>
+#include <ntv/globals.hh>
+#include <xlog/api.hh>
 
-GAF::GAF(const packet_list_t& packets, int target_len) {
-  std::vector<float> series = extractTimeSeries(packets, target_len);
-  matrix_                   = computeGAF(series);
+GAF::Params GAF::FromOptions() {
+  Params params{ .len = static_cast<int>(global::opt.gafLen) };
+  auto const& series{ global::opt.gafSeries };
+  if (series == "lengths") {
+    params.series = Series::Lengths;
+  } else if (series == "intervals") {
+    params.series = Series::Intervals;
+  } else if (series != "bytes") {
+    XLOG_WARN << "未知的 GAF 序列: " << series << ", 使用 bytes";
+  }
+  auto const& field{ global::opt.gafField };
+  if (field == "gadf") {
+    params.field = Field::Difference;
+  } else if (field != "gasf") {
+    XLOG_WARN << "未知的 GAF 类型: " << field << ", 使用 gasf";
+  }
+  return params;
 }
 
-cv::Mat GAF::getMatrix() const {
-  cv::Mat img;
-  matrix_.convertTo(img, CV_8UC1, 255.0);
-  return img;
+GAF::Stream::Stream(Params const& params)
+    : mParams{ params }
+    , mLen{ static_cast<size_t>(params.len) } {}
+
+bool GAF::Stream::Add(RawPacket const& packet) {
+  int64_t const arrive{ packet.ArriveTime() };
+  if (mParams.series != Series::Bytes) {
+    if (mChunks.size() < mLen) {
+      GrowCapped(mChunks, mChunks.size() + 1, mLen);
+      mChunks.push_back({ arrive, 0, packet.info_hdr.len });
+      return mChunks.size() >= mLen;
+    }
+    // 已满: 比保留的包都晚的不要, 更早的顶替最晚的一个
+    auto const latest{ std::ranges::max_element(mChunks, {}, &Chunk::arrive) };
+    if (arrive < latest->arrive) *latest = { arrive, 0, packet.info_hdr.len };
+    return true;
+  }
+  size_t const size{ (std::min)(static_cast<size_t>(packet.End() - packet.Beg()),
+                                mLen) };
+  if (size == 0) return mBytes.size() >= mLen;
+  if (not mChunks.empty() and arrive < mLatest) {
+    // 比已保留的包早: 插到它们之前, 只留前 len 字节
+    Merge(arrive, packet.Beg(), size);
+    return mBytes.size() >= mLen;
+  }
+  if (mBytes.size() >= mLen) return true;
+  // 每个包至少贡献一个字节, 两者都不会超过 len
+  size_t const take{ (std::min)(size, mLen - mBytes.size()) };
+  GrowCapped(mChunks, mChunks.size() + 1, mLen);
+  GrowCapped(mBytes, mBytes.size() + take, mLen);
+  mChunks.push_back({ arrive, static_cast<uint32_t>(mBytes.size()),
+                      static_cast<uint32_t>(take) });
+  mBytes.insert(mBytes.end(), packet.Beg(), packet.Beg() + take);
+  mLatest = arrive;
+  return mBytes.size() >= mLen;
 }
 
-std::vector<float> GAF::extractTimeSeries(const packet_list_t& packets,
-                                          int len) {
+void GAF::Stream::Merge(int64_t const arrive, uchar const* data,
+                        size_t const size) {
+  auto chunks{ mChunks };
+  // 新包的 offset 记为 mLen, 以此与 mBytes 中的字节区分
+  chunks.push_back({ arrive, static_cast<uint32_t>(mLen),
+                     static_cast<uint32_t>(size) });
+  std::ranges::stable_sort(chunks, {}, &Chunk::arrive);
   std::vector<uchar> bytes;
-  for (const auto& pkt : packets) {
-    if (!pkt) continue;
-    bytes.insert(bytes.end(), pkt->byte_arr.begin(), pkt->byte_arr.end());
+  bytes.reserve(mLen);
+  size_t kept{ 0 };
+  for (auto& chunk : chunks) {
+    if (bytes.size() >= mLen) break;
+    uchar const* begin{ chunk.offset == mLen ? data
+                                             : mBytes.data() + chunk.offset };
+    size_t const take{ (std::min)(size_t{ chunk.size }, mLen - bytes.size()) };
+    chunk.offset = static_cast<uint32_t>(bytes.size());
+    chunk.size   = static_cast<uint32_t>(take);
+    bytes.insert(bytes.end(), begin, begin + take);
+    ++kept;
   }
+  chunks.resize(kept);
+  // 原地覆盖, 容量只增不减
+  GrowCapped(mChunks, chunks.size(), mLen);
+  GrowCapped(mBytes, bytes.size(), mLen);
+  mChunks.assign(chunks.begin(), chunks.end());
+  mBytes.assign(bytes.begin(), bytes.end());
+  mLatest = mChunks.back().arrive;
+}
 
-  // 截断/填充
-  bytes.resize(len, 0);
+cv::Mat GAF::Stream::Finalize() {
+  auto const by_time{ [](Chunk const& a, Chunk const& b) {
+    return a.arrive < b.arrive;
+  } };
+  if (not std::ranges::is_sorted(mChunks, by_time)) {
+    // 乱序到达: 按到达时间重排, 字节序列还要重排各包的字节
+    std::ranges::stable_sort(mChunks, by_time);
+    if (mParams.series == Series::Bytes) {
+      std::vector<uchar> ordered;
+      ordered.reserve(mBytes.size());
+      for (auto const& chunk : mChunks) {
+        auto const begin{ mBytes.begin() + chunk.offset };
+        ordered.insert(ordered.end(), begin, begin + chunk.size);
+      }
+      mBytes.swap(ordered);
+    }
+  }
+  return computeGAF(BuildSeries(), mParams.field);
+}
 
-  // 归一化到 [0, 1]
-  std::vector<float> series(len);
-  for (int i = 0; i < len; ++i) {
-    series[i] = static_cast<float>(bytes[i]) / 255.0f;
+std::vector<float> GAF::Stream::BuildSeries() const {
+  // 截断/填充, 不足 len 的补 0
+  std::vector<float> series(mLen, 0.0f);
+  if (mParams.series == Series::Bytes) {
+    for (size_t i = 0; i < mBytes.size(); ++i) {
+      series[i] = static_cast<float>(mBytes[i]) / 255.0f;
+    }
+    return series;
   }
 
+  size_t const n{ mChunks.size() };
+  for (size_t i = 0; i < n; ++i) {
+    if (mParams.series == Series::Lengths) {
+      series[i] = static_cast<float>(mChunks[i].size);
+    } else if (i > 0) {
+      series[i] = static_cast<float>(mChunks[i].arrive - mChunks[i - 1].arrive);
+    }
+  }
+  // 按实际的点缩放到 [0, 1], 补的 0 不参与
+  auto const [lo, hi]{ std::minmax_element(series.begin(), series.begin() + n) };
+  if (n == 0 or *hi <= *lo) {
+    std::fill_n(series.begin(), n, 0.0f);
+    return series;
+  }
+  float const min{ *lo };
+  float const range{ *hi - *lo };
+  for (size_t i = 0; i < n; ++i) series[i] = (series[i] - min) / range;
   return series;
 }
 
-cv::Mat GAF::computeGAF(const std::vector<float>& series) {
-  int len = static_cast<int>(series.size());
-  cv::Mat gaf(len, len, CV_32FC1);
+size_t GAF::Stream::Footprint() const {
+  return sizeof(*this) + mBytes.capacity() +
+    mChunks.capacity() * sizeof(Chunk);
+}
+
+GAF::GAF(const packet_list_t& packets, Params const& params) {
+  Stream stream{ params };
+  for (const auto& pkt : packets) {
+    if (!pkt) continue;
+    if (stream.Add(*pkt)) break;
+  }
+  matrix_ = stream.Finalize();
+}
 
-  std::vector<float> phi(len);
+CaptureSpec GAF::Capture(Params const& params) {
+  auto const len{ static_cast<uint32_t>(params.len) };
+  // 每个包至少贡献一个字节
+  if (params.series == Series::Bytes) {
+    return CaptureSpec{ .bytesPerPacket = len, .packetsPerFlow = len };
+  }
+  // 长度和时间在包头信息中, 包内容只留一个字节
+  return CaptureSpec{ .bytesPerPacket = 1, .packetsPerFlow = len };
+}
+
+cv::Mat GAF::getMatrix() const { return matrix_; }
+
+cv::Mat GAF::computeGAF(const std::vector<float>& series, Field const field) {
+  int len = static_cast<int>(series.size());
+  std::vector<float> sine(len);
   for (int i = 0; i < len; ++i) {
-    phi[i] = std::acos(series[i]); // arccos(x) ∈ [0, pi]
+    // x ∈ [0, 1], φ = arccos(x), sin(φ) = √(1 - x²)
+    sine[i] = std::sqrt((std::max)(0.0f, 1.0f - series[i] * series[i]));
   }
 
+  cv::Mat gaf(len, len, CV_32FC1);
+  float const* __restrict x = series.data();
+  float const* __restrict s = sine.data();
   for (int i = 0; i < len; ++i) {
-    for (int j = 0; j < len; ++j) {
-      gaf.at<float>(i, j) = std::cos(phi[i] + phi[j]); // GASF
+    float* __restrict row = gaf.ptr<float>(i);
+    float const xi = x[i];
+    float const si = s[i];
+    if (field == Field::Summation) {
+      for (int j = 0; j < len; ++j) row[j] = xi * x[j] - si * s[j];
+    } else {
+      for (int j = 0; j < len; ++j) row[j] = si * x[j] - xi * s[j];
     }
   }
 
-  return gaf;
+  cv::Mat img;
+  if (field == Field::Summation) {
+    gaf.convertTo(img, CV_8UC1, 255.0);
+  } else {
+    gaf.convertTo(img, CV_8UC1, 127.5, 127.5);
+  }
+  return img;
 }
@@ -8,4 +8,5 @@ namespace global {
 ParseOption opt{};
 // 限制最多同时打开1000个pcap文件(linux上有限制)
 std::counting_semaphore<1024> fileSemaphore{ 1000 };
+MemoryBudget memory{};
 } // namespace global
@@ -0,0 +1,46 @@
+//
+// Created by corgi on 2025 四月 23.
+//
+
+#include <ntv/memory_budget.hh>
+
+using namespace std::chrono_literals;
+
+void MemoryBudget::Charge(int64_t const bytes) {
+  int64_t const used{ mUsed.fetch_add(bytes, std::memory_order_relaxed) +
+                      bytes };
+  int64_t peak{ mPeak.load(std::memory_order_relaxed) };
+  while (used > peak and
+         not mPeak.compare_exchange_weak(peak, used,
+                                         std::memory_order_relaxed)) {}
+}
+
+void MemoryBudget::Release(int64_t const bytes) {
+  mUsed.fetch_sub(bytes, std::memory_order_relaxed);
+  if (mWaiters.load(std::memory_order_relaxed) == 0) return;
+  std::lock_guard lock{ mMutex };
+  mCv.notify_all();
+}
+
+bool MemoryBudget::Over() const {
+  int64_t const limit{ mLimit.load(std::memory_order_relaxed) };
+  return limit > 0 and mUsed.load(std::memory_order_relaxed) >= limit;
+}
+
+void MemoryBudget::WaitForRoom() {
+  if (not Over()) return;
+  mBlocked.fetch_add(1, std::memory_order_relaxed);
+  auto const start{ std::chrono::steady_clock::now() };
+  {
+    std::unique_lock lock{ mMutex };
+    ++mWaiters;
+    // 超时只是兜底, 正常由 Release 唤醒
+    while (Over()) mCv.wait_for(lock, 100ms);
+    --mWaiters;
+  }
+  mBlockedMs.fetch_add(
+    std::chrono::duration_cast<std::chrono::milliseconds>(
+      std::chrono::steady_clock::now() - start)
+      .count(),
+    std::memory_order_relaxed);
+}
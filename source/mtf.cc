@@ -2,83 +2,103 @@
 // Created by corgi on 2025 Mar 14.
 //
 
+#include <algorithm>
 #include <utility>
 
 #include "ntv/mtf.hh"
 
-MTF::MTF(const packet_list_t& packets, int cols) {
-  std::vector<cv::Mat> matrices;
-  for (const auto& packet : packets) {
-    auto transitions = processPacket(packet);
-    matrices.push_back(computeTransitionMatrix(transitions));
-  }
-  const cv::Mat tiled_float{ tileImages(matrices, cols, 16) };
-  tiled_float.convertTo(matrix_, CV_8UC1, 255.0);
-}
-cv::Mat MTF::Matrix() const { return matrix_; }
-
-std::vector<int> MTF::processPacket(const raw_packet_t& packet) {
-  const u_char* data = packet->Data();
-  size_t length      = packet->ByteCount();
-  std::vector<bool> bits;
+MTF::Stream::Stream(int const cols)
+    : mCols{ cols } {}
 
-  // 将每个字节拆解为8个二进制位
-  for (size_t i = 0; i < length; ++i) {
-    uchar byte = data[i];
-    for (int j = 7; j >= 0; --j) { bits.push_back((byte >> j) & 1); }
+bool MTF::Stream::Add(RawPacket const& packet) {
+  // 超出画布的包不会被平铺
+  size_t const capacity{ static_cast<size_t>(mCols * mCols) };
+  int64_t const arrive{ packet.ArriveTime() };
+  if (mSlots.size() < capacity) {
+    GrowCapped(mSlots, mSlots.size() + 1, capacity);
+    auto& slot{ mSlots.emplace_back(arrive) };
+    CountNibbleTransitions(packet.Data(), packet.ByteCount(), slot.counts);
+    return mSlots.size() >= capacity;
   }
+  // 已满: 比保留的包都晚的不要, 更早的顶替最晚的一个
+  auto const latest{ std::ranges::max_element(mSlots, {}, &Slot::arrive) };
+  if (arrive >= latest->arrive) return true;
+  latest->arrive = arrive;
+  latest->counts.fill(0);
+  CountNibbleTransitions(packet.Data(), packet.ByteCount(), latest->counts);
+  return true;
+}
 
-  // 每4位一组转换为0-15的整数
-  std::vector<int> transitions;
-  for (size_t i = 0; i < bits.size(); i += 4) {
-    int val = 0;
-    for (size_t j = i; j < std::min(i + 4, bits.size()); ++j) {
-      val = (val << 1) | bits[j];
-    }
-    transitions.push_back(val);
+cv::Mat MTF::Stream::Finalize() {
+  std::ranges::stable_sort(mSlots, {}, &Slot::arrive);
+  // 每个包一块 16x16, 按行平铺, 没有包的块为 0
+  cv::Mat tiled(mCols * 16, mCols * 16, CV_8UC1, cv::Scalar{ 0 });
+  for (size_t idx = 0; idx < mSlots.size(); ++idx) {
+    size_t const row{ idx / mCols };
+    size_t const col{ idx % mCols };
+    WriteTransitionTile(mSlots[idx].counts, tiled.ptr(row * 16) + col * 16,
+                        static_cast<size_t>(tiled.cols));
   }
+  return tiled;
+}
 
-  return transitions;
+size_t MTF::Stream::Footprint() const {
+  return sizeof(*this) + mSlots.capacity() * sizeof(Slot);
 }
 
-cv::Mat MTF::computeTransitionMatrix(const std::vector<int>& transitions) {
-  cv::Mat mat{ cv::Mat::zeros(16, 16, CV_8UC1) };
-  if (transitions.size() < 2) return mat;
-  for (size_t k = 0; k < transitions.size() - 1; ++k) {
-    int i = transitions[k] & 0xF;
-    int j = transitions[k + 1] & 0xF;
-    mat.at<float>(i, j) += 1.0f;
-  }
-  for (int row = 0; row < 16; ++row) {
-    double sum{ cv::sum(mat.row(row))[0] };
-    if (sum > 0) mat.row(row) /= sum;
+MTF::MTF(const packet_list_t& packets, int cols) {
+  Stream stream{ cols };
+  for (const auto& packet : packets) {
+    if (stream.Add(*packet)) break;
   }
+  matrix_ = stream.Finalize();
+}
+cv::Mat MTF::Matrix() const { return matrix_; }
 
-  return mat;
+CaptureSpec MTF::Capture(int const cols) {
+  return CaptureSpec{ .bytesPerPacket = 0,
+                      .packetsPerFlow = static_cast<uint32_t>(cols * cols) };
 }
 
-cv::Mat MTF::tileImages(const std::vector<cv::Mat>& images, const int cols,
-                        const int dim) {
-  cv::Mat tiled(cols * dim, cols * dim, CV_8UC1, cv::Scalar{ 0 });
-  for (int idx = 0; idx < std::min((int)images.size(), cols * cols); ++idx) {
-    const int row{ idx / cols };
-    const int col{ idx % cols };
-    images[idx].copyTo(tiled(cv::Rect{ col * dim, row * dim, dim, dim }));
+Tile::Stream::Stream(int const width)
+    : mWidth{ width } {}
+
+bool Tile::Stream::Add(RawPacket const& packet) {
+  size_t const canvas{ static_cast<size_t>(mWidth * mWidth) };
+  int64_t const arrive{ packet.ArriveTime() };
+  auto const latest{ [this] {
+    return std::ranges::max_element(mSlots, {}, &Slot::arrive);
+  } };
+  // 已满: 比保留的包都晚的不要, 更早的加入后再去掉用不到的最晚的包
+  if (mBytes >= canvas and arrive >= latest()->arrive) return true;
+  // 每个包贡献 192 字节, 填满画布所需的包数即容量上限
+  GrowCapped(mSlots, mSlots.size() + 1,
+             (canvas + sizeof(AlignedPacket::bytes) - 1) /
+               sizeof(AlignedPacket::bytes));
+  mSlots.push_back({ arrive, packet.ToAligned() });
+  mBytes += mSlots.back().packet.Size();
+  while (mSlots.size() > 1) {
+    auto const last{ latest() };
+    size_t const size{ last->packet.Size() };
+    if (mBytes - size < canvas) break;
+    mBytes -= size;
+    std::swap(*last, mSlots.back());
+    mSlots.pop_back();
   }
-  return tiled;
+  return mBytes >= canvas;
 }
 
-cv::Mat Tile::Matrix() const {
-  cv::Mat img(m_width, m_width, CV_8UC1);
+cv::Mat Tile::Stream::Finalize() {
+  std::ranges::stable_sort(mSlots, {}, &Slot::arrive);
+  cv::Mat img(mWidth, mWidth, CV_8UC1);
   size_t filled = 0;
 
-  for (auto& pkt : m_packets) {
-    if (!pkt) continue;
-    auto const byte_alighed{ pkt->ToAligned() };
+  for (auto const& slot : mSlots) {
+    auto const& byte_alighed{ slot.packet };
 
-    size_t len{ std::min(byte_alighed->Size(), img.total() - filled) };
+    size_t len{ std::min(byte_alighed.Size(), img.total() - filled) };
     if (len == 0) break;
-    std::memcpy(img.data + filled, byte_alighed->Data(), len);
+    std::memcpy(img.data + filled, byte_alighed.Data(), len);
     filled += len;
   }
   if (filled < img.total()) {
@@ -87,6 +107,26 @@ cv::Mat Tile::Matrix() const {
   return img;
 }
 
-Tile::Tile(packet_list_t packets, int width)
-    : m_packets{ std::move(packets) }
-    , m_width(width) {}
+size_t Tile::Stream::Footprint() const {
+  return sizeof(*this) + mSlots.capacity() * sizeof(Slot);
+}
+
+cv::Mat Tile::Matrix() const { return m_matrix; }
+
+CaptureSpec Tile::Capture(int const width) {
+  // 以太网 + VLAN + 最长 IP 头, 再加 ToAligned 从 L4 起读取的 64 字节
+  constexpr uint32_t bytes{ 14 + 4 + 60 + 64 };
+  constexpr uint32_t aligned{ 192 };
+  uint32_t const canvas{ static_cast<uint32_t>(width * width) };
+  return CaptureSpec{ .bytesPerPacket = bytes,
+                      .packetsPerFlow = (canvas + aligned - 1) / aligned };
+}
+
+Tile::Tile(const packet_list_t& packets, int width) {
+  Stream stream{ width };
+  for (auto& pkt : packets) {
+    if (!pkt) continue;
+    if (stream.Add(*pkt)) break;
+  }
+  m_matrix = stream.Finalize();
+}
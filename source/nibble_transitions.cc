@@ -0,0 +1,126 @@
+//
+// Created by corgi on 2025 五月 02.
+//
+
+// 定义 NTV_NO_SIMD 时强制走标量路径, 测试用它对照各 SIMD 路径
+#if defined(NTV_NO_SIMD)
+#elif defined(__AVX2__)
+#define NTV_AVX2
+#include <immintrin.h>
+#elif defined(__SSE2__) or defined(_M_X64)
+#define NTV_SSE2
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#define NTV_NEON
+#include <arm_neon.h>
+#endif
+
+#include <cmath>
+
+#include <ntv/nibble_transitions.hh>
+
+namespace {
+
+// 短于该长度时直接累加, 不值得清零和合并多份计数
+constexpr size_t SHORT_INPUT = 64;
+// 一批计算的跨字节下标数
+constexpr size_t BLOCK = 32;
+
+/// 跨字节转移的下标: 本字节低半字节 << 4 | 下一字节高半字节
+inline u_char CrossIndex(u_char const cur, u_char const next) {
+  return static_cast<u_char>((cur << 4) | (next >> 4));
+}
+
+/// 计算 BLOCK 个跨字节下标, data 至少可读 BLOCK + 1 字节
+inline void CrossIndices(u_char const* data, u_char* out) {
+#if defined(NTV_AVX2)
+  __m256i const cur{ _mm256_loadu_si256(reinterpret_cast<__m256i const*>(data)) };
+  __m256i const next{
+    _mm256_loadu_si256(reinterpret_cast<__m256i const*>(data + 1))
+  };
+  // 按 16 位移位, 掩掉从相邻字节移进来的位
+  __m256i const hi{ _mm256_and_si256(_mm256_slli_epi16(cur, 4),
+                                     _mm256_set1_epi8(static_cast<char>(0xF0))) };
+  __m256i const lo{ _mm256_and_si256(_mm256_srli_epi16(next, 4),
+                                     _mm256_set1_epi8(0x0F)) };
+  _mm256_storeu_si256(reinterpret_cast<__m256i*>(out), _mm256_or_si256(hi, lo));
+#elif defined(NTV_SSE2)
+  for (size_t i = 0; i < BLOCK; i += 16) {
+    __m128i const cur{ _mm_loadu_si128(reinterpret_cast<__m128i const*>(data + i)) };
+    __m128i const next{
+      _mm_loadu_si128(reinterpret_cast<__m128i const*>(data + i + 1))
+    };
+    __m128i const hi{ _mm_and_si128(_mm_slli_epi16(cur, 4),
+                                    _mm_set1_epi8(static_cast<char>(0xF0))) };
+    __m128i const lo{ _mm_and_si128(_mm_srli_epi16(next, 4),
+                                    _mm_set1_epi8(0x0F)) };
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i), _mm_or_si128(hi, lo));
+  }
+#elif defined(NTV_NEON)
+  for (size_t i = 0; i < BLOCK; i += 16) {
+    uint8x16_t const cur{ vld1q_u8(data + i) };
+    uint8x16_t const next{ vld1q_u8(data + i + 1) };
+    vst1q_u8(out + i, vorrq_u8(vshlq_n_u8(cur, 4), vshrq_n_u8(next, 4)));
+  }
+#else
+  for (size_t i = 0; i < BLOCK; ++i) out[i] = CrossIndex(data[i], data[i + 1]);
+#endif
+}
+
+} // namespace
+
+void CountNibbleTransitions(u_char const* data, size_t const len,
+                            transition_counts_t& counts) {
+  if (len == 0) return;
+  if (len < SHORT_INPUT) {
+    for (size_t i = 0; i + 1 < len; ++i) {
+      ++counts[data[i]];
+      ++counts[CrossIndex(data[i], data[i + 1])];
+    }
+    ++counts[data[len - 1]];
+    return;
+  }
+
+  // 四份计数轮流累加, 相邻的相同下标不会互相等待写回
+  std::array<transition_counts_t, 4> part{};
+  u_char cross[BLOCK];
+  size_t i{ 0 };
+  for (; i + BLOCK < len; i += BLOCK) {
+    CrossIndices(data + i, cross);
+    for (size_t j = 0; j < BLOCK; j += 4) {
+      ++part[0][data[i + j]];
+      ++part[1][cross[j]];
+      ++part[2][data[i + j + 1]];
+      ++part[3][cross[j + 1]];
+      ++part[0][data[i + j + 2]];
+      ++part[1][cross[j + 2]];
+      ++part[2][data[i + j + 3]];
+      ++part[3][cross[j + 3]];
+    }
+  }
+  for (; i + 1 < len; ++i) {
+    ++part[0][data[i]];
+    ++part[1][CrossIndex(data[i], data[i + 1])];
+  }
+  ++part[2][data[len - 1]];
+
+  for (size_t k = 0; k < counts.size(); ++k) {
+    counts[k] += part[0][k] + part[1][k] + part[2][k] + part[3][k];
+  }
+}
+
+void WriteTransitionTile(transition_counts_t const& counts, u_char* out,
+                         size_t const stride) {
+  for (size_t row = 0; row < 16; ++row) {
+    uint64_t sum{ 0 };
+    for (size_t col = 0; col < 16; ++col) sum += counts[row * 16 + col];
+    u_char* line{ out + row * stride };
+    for (size_t col = 0; col < 16; ++col) {
+      // 与 convertTo(CV_8U, 255) 一致: 就近取整, 概率不超过 1 无需饱和
+      line[col] = sum == 0 ? 0
+                           : static_cast<u_char>(std::lrint(
+                               255.0 * counts[row * 16 + col] /
+                               static_cast<double>(sum)));
+    }
+  }
+}
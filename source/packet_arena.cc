@@ -0,0 +1,117 @@
+﻿//
+// Created by corgi on 2025 四月 24.
+//
+
+#include <new>
+#include <type_traits>
+
+#include <moodycamel/concurrent_queue.hh>
+#include <ntv/globals.hh>
+#include <ntv/packet_arena.hh>
+
+static_assert(std::is_trivially_destructible_v<RawPacket>,
+              "slab 整块回收, RawPacket 不能依赖析构");
+
+namespace {
+constexpr int64_t BIAS = int64_t{ 1 } << 40;
+// 池中最多保留的空闲 slab 数
+constexpr size_t POOL_MAX = 64;
+// 链表节点等随包分配的开销估算, 随 slab 一起计入预算
+constexpr int64_t NODE_OVERHEAD = 32;
+
+constexpr size_t AlignUp(size_t const n) {
+  constexpr size_t align{ alignof(RawPacket) };
+  return (n + align - 1) & ~(align - 1);
+}
+constexpr size_t SLAB_HEADER = AlignUp(sizeof(PacketSlab));
+
+/// 回收的常规 slab, 所有读线程共用
+class SlabPool {
+public:
+  ~SlabPool() {
+    PacketSlab* slab;
+    while (mQueue.try_dequeue(slab)) ::operator delete(slab);
+  }
+  PacketSlab* Take() {
+    PacketSlab* slab;
+    if (not mQueue.try_dequeue(slab)) return nullptr;
+    mSize.fetch_sub(1, std::memory_order_relaxed);
+    return slab;
+  }
+  /// 池满时返回 false, 由调用方释放
+  bool Give(PacketSlab* slab) {
+    if (mSize.fetch_add(1, std::memory_order_relaxed) >= POOL_MAX) {
+      mSize.fetch_sub(1, std::memory_order_relaxed);
+      return false;
+    }
+    mQueue.enqueue(slab);
+    return true;
+  }
+
+private:
+  moodycamel::ConcurrentQueue<PacketSlab*> mQueue;
+  std::atomic<size_t> mSize{ 0 };
+};
+SlabPool gPool;
+
+PacketSlab* NewSlab(size_t const bytes, int64_t const refs) {
+  void* memory{ bytes == PacketArena::SLAB_BYTES ? gPool.Take() : nullptr };
+  if (memory == nullptr) memory = ::operator new(bytes);
+  auto const slab{ new (memory) PacketSlab{} };
+  slab->refs.store(refs, std::memory_order_relaxed);
+  slab->capacity = static_cast<uint32_t>(bytes);
+  slab->charged  = static_cast<uint32_t>(bytes);
+  global::memory.Charge(static_cast<int64_t>(bytes));
+  return slab;
+}
+} // namespace
+
+void ReleaseSlab(PacketSlab* slab) {
+  global::memory.Release(slab->charged);
+  bool const regular{ slab->capacity == PacketArena::SLAB_BYTES };
+  slab->~PacketSlab();
+  if (regular and gPool.Give(slab)) return;
+  ::operator delete(slab);
+}
+
+PacketArena::~PacketArena() { Retire(); }
+
+raw_packet_t PacketArena::Allocate(pcap_pkthdr const* pkthdr,
+                                   u_char const* packet,
+                                   PacketMeta const& meta,
+                                   uint32_t const length) {
+  size_t const bytes{ AlignUp(sizeof(RawPacket) + length) };
+  if (bytes > LARGE_PACKET) {
+    // 大包独占一块, 不影响当前 slab
+    auto const slab{ NewSlab(SLAB_HEADER + bytes, 1) };
+    global::memory.Charge(NODE_OVERHEAD);
+    slab->charged += NODE_OVERHEAD;
+    auto const memory{ reinterpret_cast<std::byte*>(slab) + SLAB_HEADER };
+    return raw_packet_t{ new (memory)
+                           RawPacket{ pkthdr, packet, meta, length, slab } };
+  }
+  if (mSlab == nullptr or mUsed + bytes > SLAB_BYTES) {
+    Retire();
+    mSlab = NewSlab(SLAB_BYTES, BIAS);
+    mUsed = SLAB_HEADER;
+  }
+  auto const memory{ reinterpret_cast<std::byte*>(mSlab) + mUsed };
+  mUsed += bytes;
+  ++mIssued;
+  return raw_packet_t{ new (memory)
+                         RawPacket{ pkthdr, packet, meta, length, mSlab } };
+}
+
+void PacketArena::Retire() {
+  if (mSlab == nullptr) return;
+  int64_t const overhead{ mIssued * NODE_OVERHEAD };
+  global::memory.Charge(overhead);
+  mSlab->charged += static_cast<uint32_t>(overhead);
+  // 计数剩下的就是仍存活的句柄数
+  int64_t const drop{ BIAS - mIssued };
+  if (mSlab->refs.fetch_sub(drop, std::memory_order_acq_rel) == drop) {
+    ReleaseSlab(mSlab);
+  }
+  mSlab   = nullptr;
+  mIssued = 0;
+}
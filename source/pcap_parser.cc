@@ -2,6 +2,7 @@
 #include <ntv/globals.hh>
 #include <ntv/mtf.hh>
 #include <ntv/pcap_parser.hh>
+#include <ntv/pcap_reader.hh>
 #include <opencv2/opencv.hpp>
 #include <pcap/pcap.h>
 #include <xlog/api.hh>
@@ -10,152 +11,1159 @@ using namespace std::chrono_literals;
 namespace fs = std::filesystem;
 
 // === 构造函数 ===
-PcapParser::PcapParser() {
-  for (int i = 0; i < SHARD_COUNT; ++i) {
-    mShards[i].thread =
-      std::jthread{ [this, i](const std::stop_token& st) { RunShard(i, st); } };
+PcapParser::PcapParser()
+    : mReaderCpus{ ParseCpuList(global::opt.readerCpus) }
+    , mShardCpus{ ParseCpuList(global::opt.shardCpus) }
+    , mWriterCpus{ ParseCpuList(global::opt.writerCpus) }
+    , mShardCount{ ShardCount() }
+    , mWriterCount{ WriterCount() }
+    , mShardsReady{ static_cast<std::ptrdiff_t>(mShardCount) }
+    , mEncodeTasks{ mShardCount } {
+  global::memory.SetLimit(static_cast<int64_t>(global::opt.memoryMB) << 20);
+  mFormats = SplitFormats(global::opt.outfmt);
+  if (mFormats.empty()) {
+    XLOG_ERROR << "没有指定输出格式";
+    exit(EXIT_FAILURE);
+  }
+  mFormatStats = std::make_unique<FormatStats[]>(mFormats.size());
+  for (size_t f = 0; f < mFormats.size(); ++f) {
+    auto const spec{ CaptureFor(mFormats[f]) };
+    if (not spec.has_value()) {
+      XLOG_ERROR << "未知的输出格式: " << mFormats[f];
+      exit(EXIT_FAILURE);
+    }
+    mCapture = f == 0 ? *spec : mCapture.Merge(*spec);
+    mEncoders.push_back(EncoderFor(mFormats[f]));
+  }
+  // 有一个格式不能流式编码就整体缓存包, 各格式都从同一份包编码
+  if (std::ranges::find(mEncoders, nullptr) != mEncoders.end()) {
+    mEncoders.clear();
   }
+  mWallClock = global::opt.clock == "wall";
+  XLOG_INFO << "输出格式: " << mFormats.size() << " 种, 每包保存字节: "
+            << mCapture.bytesPerPacket
+            << ", 每流缓存包数: " << mCapture.packetsPerFlow << " (0 为不限)"
+            << ", 流式编码: " << (not mEncoders.empty() ? "是" : "否");
+  XLOG_INFO << "Shard 数: " << mShardCount << ", 写线程数: " << mWriterCount;
 
-  for (int i = 0; i < WRITER_THREAD_COUNT; ++i) {
-    mWriterThreads.emplace_back(
-      [this](const std::stop_token& st) { RunWriter(st); });
+  // shard 状态由各自线程绑核后分配, 等全部就绪后读线程才能分发
+  mShards.resize(mShardCount);
+  for (size_t i = 0; i < mShardCount; ++i) {
+    mShardThreads.emplace_back(
+      [this, i](const std::stop_token& st) { RunShard(i, st); });
+  }
+  mShardsReady.wait();
+
+  for (size_t i = 0; i < mWriterCount; ++i) {
+    mWriterThreads.emplace_back([this, i] { RunWriter(i); });
   }
 }
 
 // === 析构函数 ===
 PcapParser::~PcapParser() {
-  XLOG_INFO << "析构函数开始, 等待写队列处理: " << mWriteQueue.size_approx();
+  XLOG_INFO << "析构函数开始, 等待写队列处理: " << mEncodeTasks.SizeApprox();
 
-  for (int i = 0; i < mWriterThreads.size(); ++i) {
-    XLOG_DEBUG << "Join前 mWriterThreads[" << i
-               << "] joinable: " << mWriterThreads[i].joinable();
+  // shard 收到 stop 后取完队列、flush 所有剩余的流再退出
+  for (size_t i = 0; i < mShardCount; ++i) {
+    mShardThreads[i].request_stop();
+    mShards[i]->wake.signal();
+  }
+  uint64_t skipped{ 0 }, dropped{ 0 };
+  uint64_t max_packets{ 0 }, total_packets{ 0 };
+  uint64_t max_flows{ 0 }, total_flows{ 0 };
+  for (size_t i = 0; i < mShardCount; ++i) {
+    mShardThreads[i].join();
+    auto const& shard{ *mShards[i] };
+    skipped += shard.skipped;
+    dropped += shard.dropped;
+    max_packets = (std::max)(max_packets, shard.packets);
+    total_packets += shard.packets;
+    max_flows = (std::max)(max_flows, shard.flowCount);
+    total_flows += shard.flowCount;
+    for (size_t f = 0; f < shard.foldNs.size(); ++f) {
+      mFormatStats[f].foldNs += shard.foldNs[f] * FOLD_SAMPLE;
+    }
   }
+  // 最重的 shard 与平均值之比, 1 为完全均衡
+  auto const skew{ [this](uint64_t const max, uint64_t const total) {
+    return total == 0 ? 1.0
+                      : static_cast<double>(max * mShardCount) /
+        static_cast<double>(total);
+  } };
+  XLOG_INFO << "Shard 倾斜(最大/平均): 包 " << skew(max_packets, total_packets)
+            << ", 流 " << skew(max_flows, total_flows);
 
-  while (mWriteQueue.size_approx()) { std::this_thread::sleep_for(1000ms); }
+  // 此后不会再有流入队, 写线程写完队列中剩余的流即退出
+  mWriteClosed.store(true, std::memory_order_release);
+  mEncodeTasks.WakeAll(mWriterThreads.size());
+  for (auto& writer : mWriterThreads) writer.join();
 
   XLOG_INFO << "析构函数结束, 写队列已清空";
+  // 各格式的总耗时(各线程之和), 折叠只在流式编码时有, 由抽样估计
+  for (size_t f = 0; f < mFormats.size(); ++f) {
+    auto const& stats{ mFormatStats[f] };
+    XLOG_INFO << "格式 " << mFormats[f] << ": " << stats.flows
+              << " 条流, 折叠(估计) " << stats.foldNs / 1000000 << " ms, 编码 "
+              << stats.encodeNs / 1000000 << " ms, 写出 "
+              << stats.writeNs / 1000000 << " ms";
+  }
+  XLOG_INFO << "内存峰值: " << (global::memory.Peak() >> 20)
+            << " MB, 读线程阻塞: " << global::memory.BackpressureCount()
+            << " 次/" << global::memory.BackpressureTime().count()
+            << " ms, 提前驱逐: " << global::memory.EvictionCount()
+            << " 条流, 预算不足删除的墓碑: " << dropped << " 条";
+  XLOG_INFO << "输入: " << (mIngestBytes >> 20) << " MB, 保存: "
+            << (mStoredBytes >> 20) << " MB, 超出编码需要未缓存: " << skipped
+            << " 包, 大流只计数: " << mCountedOnly << " 包, 改派: "
+            << mRebalanced << " 条流";
 }
 
 // === 解析主流程 ===
-void PcapParser::ParseFile(fs::path const& pcap_file) {
-  mInputFile = pcap_file;
-  mParentDir = pcap_file.parent_path();
-  mOutputDir = mInputFile.stem();
-  mInputFile = mInputFile.stem();
+std::future<void> PcapParser::ParseFile(fs::path const& pcap_file) {
+  return ParseFile(pcap_file, FileContext{ {}, {} },
+                   ReaderCount());
+}
 
-  std::array<char, PCAP_ERRBUF_SIZE> err_buff{};
-  mHandle = pcap_open_offline(pcap_file.string().c_str(), err_buff.data());
-  if (mHandle == nullptr) {
-    XLOG_ERROR << err_buff;
+void PcapParser::ParseDirectory(fs::path const& input_dir) {
+  std::vector<fs::path> files;
+  for (auto const& entry : fs::recursive_directory_iterator{ input_dir }) {
+    if (not entry.is_regular_file()) continue;
+    auto const ext{ entry.path().extension() };
+    if (ext == ".pcap" or ext == ".cap" or ext == ".pcapng") {
+      files.emplace_back(entry.path());
+    }
+  }
+  std::ranges::sort(files);
+
+  size_t const jobs{ (std::min)(JobCount(),
+                                (std::max)(files.size(), size_t{ 1 })) };
+  size_t const readers{ (std::max)(ReaderCount() / jobs, size_t{ 1 }) };
+  XLOG_INFO << "批量模式: " << files.size() << " 个文件, 并发 " << jobs;
+
+  // 读完一个文件立即读下一个, 不等它的流写出
+  std::vector<std::future<void>> pending(files.size());
+  std::atomic<size_t> next{ 0 };
+  {
+    std::vector<std::jthread> workers;
+    for (size_t i = 0; i < jobs; ++i) {
+      workers.emplace_back([&] {
+        for (size_t idx = next++; idx < files.size(); idx = next++) {
+          auto const& file{ files[idx] };
+          // 镜像 label 目录结构
+          auto const label{ fs::relative(file.parent_path(), input_dir) };
+          pending[idx] =
+            ParseFile(file,
+                      FileContext{ label,
+                                   file.stem().string() + "_" },
+                      readers);
+        }
+      });
+    }
+  }
+  for (auto& done : pending) done.wait();
+}
+
+std::future<void> PcapParser::ParseFile(fs::path const& pcap_file,
+                                        FileContext context,
+                                        size_t const readers) {
+  XLOG_INFO << "开始: " << pcap_file.string();
+  for (size_t f = 0; f < mFormats.size(); ++f) {
+    std::error_code ec;
+    auto const dir{ FormatDir(context.label, f) };
+    fs::create_directories(dir, ec);
+    if (ec) {
+      XLOG_WARN << "创建输出目录失败: " << dir << ", " << ec.message();
+    }
+  }
+
+  auto const job{ std::make_shared<FileJob>() };
+  job->input   = pcap_file;
+  job->context = std::move(context);
+  job->pending = static_cast<int64_t>(mShardCount);
+  auto done{ job->done.get_future() };
+  uint16_t const source{ AddJob(job) };
+
+  // 限制同时打开的文件数
+  global::fileSemaphore.acquire();
+  auto const start{ std::chrono::steady_clock::now() };
+  std::optional<uint64_t> records;
+  // 实际用的读取方式, mmap 打不开时会回退到 libpcap
+  char const* reader{ "pcap" };
+  if (global::opt.reader != "pcap") {
+    records = ReadWithMmap(pcap_file, source, readers);
+    if (records.has_value()) reader = "mmap";
+  }
+  if (not records.has_value()) records = ReadWithLibpcap(pcap_file, source);
+  global::fileSemaphore.release();
+
+  std::chrono::duration<double> const elapsed{ std::chrono::steady_clock::now() -
+                                               start };
+  double const seconds{ (std::max)(elapsed.count(), 1e-6) };
+  XLOG_INFO << "读取完成[" << reader << "]: " << *records
+            << " 包, 耗时 " << seconds << "s, "
+            << static_cast<uint64_t>(*records / seconds) << " pps";
+
+  // 通知所有 shard 该文件已读完
+  for (auto& shard : mShards) {
+    shard->eofQueue.enqueue(source);
+    shard->wake.signal();
+  }
+  return done;
+}
+
+std::shared_ptr<PcapParser::FileJob> PcapParser::FindJob(
+  uint16_t const source) {
+  std::shared_lock lock{ mJobsMutex };
+  return mJobs.at(source);
+}
+
+uint16_t PcapParser::AddJob(std::shared_ptr<FileJob> job) {
+  constexpr uint32_t source_count{ uint32_t{ UINT16_MAX } + 1 };
+  std::unique_lock lock{ mJobsMutex };
+  // 还没写完的文件仍占着 source, 复用会和它的流混在一起
+  mSourceCv.wait(lock, [this] {
+    return not mFreeSources.empty() or mNextSource < source_count;
+  });
+  uint16_t source;
+  if (not mFreeSources.empty()) {
+    source = mFreeSources.back();
+    mFreeSources.pop_back();
+  } else {
+    source = static_cast<uint16_t>(mNextSource++);
+  }
+  if (not mJobs.try_emplace(source, std::move(job)).second) {
+    XLOG_ERROR << "source " << source << " 仍在使用";
     exit(EXIT_FAILURE);
   }
+  return source;
+}
+
+void PcapParser::EmitFlow(FlowShard const& shard, FlowEntry& entry) {
+  FindJob(entry.key.source)->pending.fetch_add(1, std::memory_order_relaxed);
+  mEncodeTasks.Push(shard.id, { entry.key, entry.start, std::move(entry.list),
+                                std::move(entry.encoders) });
+  entry.list.clear();
+  entry.encoders.clear();
+}
+
+void PcapParser::RegisterReaders(uint16_t const source, size_t const count) {
+  auto const job{ FindJob(source) };
+  job->readers = std::make_unique<ReaderSlot[]>(count);
+  job->readerCount.store(count, std::memory_order_release);
+}
+
+bool PcapParser::SharedSource(FlowShard& shard, uint16_t const source) {
+  auto const [it, inserted]{ shard.readers.try_emplace(source, 0) };
+  // 读线程数在分发第一个包之前就已登记
+  if (inserted) {
+    it->second = FindJob(source)->readerCount.load(std::memory_order_acquire);
+  }
+  return it->second > 1;
+}
+
+void PcapParser::ReleaseJob(uint16_t const source) {
+  auto const job{ FindJob(source) };
+  if (job->pending.fetch_sub(1, std::memory_order_acq_rel) != 1) return;
+  {
+    std::unique_lock lock{ mJobsMutex };
+    mJobs.erase(source);
+    mFreeSources.push_back(source);
+  }
+  mSourceCv.notify_one();
+  XLOG_INFO << "完成: " << job->input.string() << ", 流数: " << job->flows;
+  job->done.set_value();
+}
+
+uint64_t PcapParser::ReadWithLibpcap(fs::path const& pcap_file,
+                                     uint16_t const source) {
+  std::array<char, PCAP_ERRBUF_SIZE> err_buff{};
+  pcap_t* handle{ pcap_open_offline(pcap_file.string().c_str(),
+                                    err_buff.data()) };
+  if (handle == nullptr) {
+    XLOG_ERROR << err_buff.data();
+    return 0;
+  }
 
   constexpr bpf_u_int32 net = 0;
   bpf_program fp{};
-  if (pcap_compile(mHandle, &fp, global::opt.filter.c_str(), 0, net) == -1) {
-    XLOG_ERROR << "编译filter失败: " << pcap_geterr(mHandle);
+  if (pcap_compile(handle, &fp, global::opt.filter.c_str(), 0, net) == -1) {
+    XLOG_ERROR << "编译filter失败: " << pcap_geterr(handle);
     exit(EXIT_FAILURE);
   }
 
-  if (pcap_setfilter(mHandle, &fp) == -1) {
-    XLOG_ERROR << "设置filter失败: " << pcap_geterr(mHandle);
+  if (pcap_setfilter(handle, &fp) == -1) {
+    XLOG_ERROR << "设置filter失败: " << pcap_geterr(handle);
     exit(EXIT_FAILURE);
   }
 
   pcap_freecode(&fp);
-  pcap_loop(mHandle, 0, DeadHandler, reinterpret_cast<u_char*>(this));
-  pcap_close(mHandle);
+  // 在调用者的线程里读, 不改它的绑核
+  RegisterReaders(source, 1);
+  LoopContext loop{ { *this, source, 0, true, false }, 0 };
+  pcap_loop(handle, 0, DeadHandler, reinterpret_cast<u_char*>(&loop));
+  pcap_close(handle);
   XLOG_INFO << "pcap_loop 解析完成";
+  return loop.count;
+}
+
+std::optional<uint64_t> PcapParser::ReadWithMmap(fs::path const& pcap_file,
+                                                 uint16_t const source,
+                                                 size_t const readers) {
+  PcapReader reader{ pcap_file };
+  if (not reader.IsOpen()) {
+    XLOG_WARN << reader.Error() << ", 回退到 libpcap";
+    return std::nullopt;
+  }
+  if (not reader.SetFilter(global::opt.filter)) {
+    XLOG_ERROR << reader.Error();
+    exit(EXIT_FAILURE);
+  }
+  // 小文件不值得切分, 每段至少 MIN_CHUNK_BYTES
+  size_t const max_parts{ (std::max)(reader.Size() / MIN_CHUNK_BYTES,
+                                     size_t{ 1 }) };
+  auto bounds{ reader.Split((std::min)(readers, max_parts)) };
+  size_t const parts{ bounds.size() - 1 };
+
+  // 切分点是猜的: 先只沿记录头把每段走一遍, 某段实际停下的位置越过了下一段的
+  // 起点, 说明那个起点落在记录中间, 改从实际停下的位置开始, 再重走下一段
+  if (parts > 1) {
+    std::vector<size_t> stops(parts);
+    {
+      std::vector<std::jthread> walkers;
+      for (size_t i = 0; i < parts; ++i) {
+        walkers.emplace_back(
+          [&, i] { stops[i] = reader.Follow(bounds[i], bounds[i + 1]); });
+      }
+    }
+    for (size_t i = 0; i + 1 < parts; ++i) {
+      if (stops[i] <= bounds[i + 1]) continue;
+      XLOG_WARN << "分段 " << i + 1 << " 的起点 " << bounds[i + 1]
+                << " 不是记录边界, 改为 " << stops[i];
+      bounds[i + 1] = stops[i];
+      stops[i + 1]  = reader.Follow(bounds[i + 1], bounds[i + 2]);
+    }
+  }
+
+  // 只分一段时读线程独占该文件, 可以改派新流
+  bool const exclusive{ parts == 1 };
+  std::vector<PcapReader::WalkResult> results(parts);
+  RegisterReaders(source, parts);
+  {
+    std::vector<std::jthread> workers;
+    for (size_t i = 0; i < parts; ++i) {
+      workers.emplace_back([&, i] {
+        DispatchBuffer buffer{ *this, source, i, exclusive, true };
+        results[i] = reader.Walk(
+          bounds[i], bounds[i + 1],
+          [&buffer](const pcap_pkthdr* pkthdr, const u_char* packet) {
+            buffer.Push(pkthdr, packet);
+          });
+      });
+    }
+  }
+
+  uint64_t records{ 0 };
+  for (size_t i = 0; i < parts; ++i) {
+    auto const& result{ results[i] };
+    records += result.records;
+    if (result.resyncs > 0) {
+      XLOG_ERROR << "分段 " << i << " 有 " << result.resyncs
+                 << " 处记录头不合理, 共跳过 " << result.skipped << " 字节";
+    }
+  }
+  XLOG_INFO << "mmap 解析完成, 分段数: " << parts;
+  return records;
+}
+
+size_t PcapParser::ReaderCount() {
+  if (global::opt.readers > 0) return global::opt.readers;
+  return (std::max)(std::thread::hardware_concurrency() / 2, 1u);
+}
+
+size_t PcapParser::JobCount() {
+  if (global::opt.jobs > 0) return global::opt.jobs;
+  return (std::max)(std::thread::hardware_concurrency(), 1u);
+}
+
+size_t PcapParser::ShardCount() const {
+  if (global::opt.shards > 0) return global::opt.shards;
+  // 给了绑核列表时每核一个 shard, 不超订也不空闲
+  return not mShardCpus.empty() ? mShardCpus.size() : DEFAULT_SHARDS;
+}
+
+size_t PcapParser::WriterCount() const {
+  if (global::opt.writers > 0) return global::opt.writers;
+  return not mWriterCpus.empty() ? mWriterCpus.size() : DEFAULT_WRITERS;
+}
+
+std::optional<CaptureSpec> PcapParser::CaptureFor(std::string const& fmt) {
+  if (fmt == "tile") return Tile::Capture();
+  if (fmt == "mtf") return MTF::Capture();
+  if (fmt == "gaf") return GAF::Capture(GAF::FromOptions());
+  return std::nullopt;
+}
+
+std::vector<std::string> PcapParser::SplitFormats(std::string const& formats) {
+  std::vector<std::string> result;
+  std::string_view rest{ formats };
+  while (not rest.empty()) {
+    size_t const comma{ rest.find(',') };
+    std::string fmt{ rest.substr(0, comma) };
+    rest = comma == std::string_view::npos ? std::string_view{}
+                                           : rest.substr(comma + 1);
+    if (fmt.empty() or std::ranges::find(result, fmt) != result.end()) continue;
+    result.push_back(std::move(fmt));
+  }
+  return result;
+}
+
+encoder_factory_t PcapParser::EncoderFor(std::string const& fmt) {
+  if (fmt == "tile") {
+    return []() -> std::unique_ptr<FlowEncoder> {
+      return std::make_unique<Tile::Stream>();
+    };
+  }
+  if (fmt == "mtf") {
+    return []() -> std::unique_ptr<FlowEncoder> {
+      return std::make_unique<MTF::Stream>();
+    };
+  }
+  if (fmt == "gaf") {
+    return []() -> std::unique_ptr<FlowEncoder> {
+      static GAF::Params const params{ GAF::FromOptions() };
+      return std::make_unique<GAF::Stream>(params);
+    };
+  }
+  return nullptr;
 }
 
 // === 将packet分发给shard ===
 void PcapParser::DeadHandler(u_char* user_data, const pcap_pkthdr* pkthdr,
                              const u_char* packet) {
-  auto raw{ std::make_shared<RawPacket>(pkthdr, packet) };
-  auto const self{ reinterpret_cast<PcapParser*>(user_data) };
-  auto const opt_key{ raw->GetFlowKey() };
-  if (not opt_key.has_value()) return;
+  auto const loop{ reinterpret_cast<LoopContext*>(user_data) };
+  ++loop->count;
+  loop->buffer.Push(pkthdr, packet);
+}
+
+size_t PcapParser::AcquireLane(bool const pin) {
+  std::unique_lock lock{ mLaneMutex };
+  if (mFreeLanes.empty()) {
+    size_t const count{ mLaneCount.load(std::memory_order_relaxed) };
+    if (count < MAX_LANES) {
+      // 先绑核再分配, 环落在读线程所在的 NUMA 节点
+      if (pin) PinCurrentThread(mReaderCpus, count);
+      mLanes[count] = std::make_unique<ReaderLane>(mShardCount);
+      mLaneCount.store(count + 1, std::memory_order_release);
+      return count;
+    }
+    mLaneCv.wait(lock, [this] { return not mFreeLanes.empty(); });
+  }
+  size_t const lane{ mFreeLanes.back() };
+  mFreeLanes.pop_back();
+  if (pin) PinCurrentThread(mReaderCpus, lane);
+  return lane;
+}
+
+void PcapParser::ReleaseLane(size_t const lane) {
+  {
+    std::lock_guard lock{ mLaneMutex };
+    mFreeLanes.push_back(lane);
+  }
+  mLaneCv.notify_one();
+}
+
+void PcapParser::Notify(FlowShard& shard) {
+  // 与 shard 置位 sleeping 后复查环的顺序配对, 保证不丢唤醒
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  if (shard.sleeping.load(std::memory_order_relaxed) and
+      shard.sleeping.exchange(false)) {
+    shard.wake.signal();
+  }
+}
+
+// 一代 Bloom filter 覆盖最长的空闲超时, 有协议不超时则不轮换
+static uint64_t SeenWindow() {
+  auto const& opt{ global::opt };
+  if (opt.tcp.idle.count() <= 0 or opt.udp.idle.count() <= 0) return 0;
+  return std::chrono::microseconds{ (std::max)(opt.tcp.idle, opt.udp.idle) }
+    .count();
+}
+
+PcapParser::DispatchBuffer::DispatchBuffer(PcapParser& parser,
+                                           uint16_t const source,
+                                           size_t const reader,
+                                           bool const exclusive,
+                                           bool const pin)
+    : mParser{ parser }
+    , mSource{ source }
+    , mSlot{ parser.FindJob(source)->readers[reader] }
+    , mExclusive{ exclusive }
+    , mLaneId{ parser.AcquireLane(pin) }
+    , mLane{ *parser.mLanes[mLaneId] }
+    , mHeavyWindow{ SeenWindow() }
+    , mSeen{ SeenWindow() }
+    , mRedirected(parser.mShardCount, 0) {
+  // lane 上一个使用者留下的进度属于别的文件
+  for (size_t i = 0; i < parser.mShardCount; ++i) {
+    mLane.progress[i].store(0, std::memory_order_relaxed);
+  }
+  mSlot.lane.store(mLaneId, std::memory_order_release);
+}
+
+PcapParser::DispatchBuffer::~DispatchBuffer() {
+  // 计数在文件结束通知之前交给 shard
+  for (auto& [key, heavy] : mHeavy) {
+    SendTally(key, HashFlowKey(key, global::opt.hashSeed), heavy);
+  }
+  Flush();
+  // 先记下各环的终点再置位, shard 看到 done 后只按终点判断是否取完
+  mSlot.tails.resize(mParser.mShardCount);
+  for (size_t i = 0; i < mParser.mShardCount; ++i) {
+    mSlot.tails[i] = mLane.rings[i].Published();
+  }
+  mSlot.done.store(true, std::memory_order_release);
+  mParser.ReleaseLane(mLaneId);
+  mParser.mIngestBytes.fetch_add(mIngestBytes, std::memory_order_relaxed);
+  mParser.mStoredBytes.fetch_add(mStoredBytes, std::memory_order_relaxed);
+  mParser.mCountedOnly.fetch_add(mCountedOnly, std::memory_order_relaxed);
+  mParser.mRebalanced.fetch_add(mRebalanced, std::memory_order_relaxed);
+}
+
+void PcapParser::DispatchBuffer::Push(const pcap_pkthdr* pkthdr,
+                                      const u_char* packet) {
+  if (global::memory.Over()) {
+    // 阻塞前把已写入环的包交出去, shard 才能继续消费和驱逐
+    Flush();
+    global::memory.WaitForRoom();
+  }
+  mIngestBytes += pkthdr->len;
+  // 只在这里解析一次头部, 结果随包传给 shard 和编码器
+  auto const meta{ PacketMeta::Decode(packet, pkthdr->caplen, mSource) };
+  if (not meta.has_value()) return;
+
+  uint64_t const hash{ HashFlowKey(meta->key, global::opt.hashSeed) };
+  uint64_t const arrive{ static_cast<uint64_t>(pkthdr->ts.tv_sec) * 1000000 +
+                         static_cast<uint64_t>(pkthdr->ts.tv_usec) };
+  mArrive = arrive;
+  // 长时间没有包发往的 shard 也要知道本读线程已读到哪里
+  if (++mPushed % PROGRESS_INTERVAL == 0) {
+    for (size_t i = 0; i < mParser.mShardCount; ++i) {
+      if (mLane.rings[i].Unpublished() > 0) continue;
+      mLane.progress[i].store(mArrive, std::memory_order_release);
+    }
+  }
+  if (CountHeavy(meta->key, hash, arrive, pkthdr->len)) return;
 
-  size_t const shard_id{ std::hash<FlowKey>{}(opt_key.value()) % SHARD_COUNT };
-  self->mShards[shard_id].packetQueue.enqueue(std::move(raw));
+  size_t const shard_id{ PickShard(meta->key, hash, arrive) };
+  // 编码器用不到的尾部字节不拷贝, info_hdr 仍保留原始长度
+  uint32_t const length{ mParser.mCapture.Clamp(pkthdr->caplen) };
+  auto raw{ mArena.Allocate(pkthdr, packet, *meta, length) };
+  mStoredBytes += length;
+  Dispatch(shard_id, std::move(raw));
+}
+
+void PcapParser::DispatchBuffer::Dispatch(size_t const shard_id,
+                                          raw_packet_t&& raw) {
+  auto& ring{ mLane.rings[shard_id] };
+  while (not ring.TryPush(std::move(raw))) {
+    // 环满: 先把已写入的交出去, 等 shard 消费
+    Publish(shard_id);
+    std::this_thread::yield();
+  }
+  if (ring.Unpublished() < DISPATCH_BATCH) return;
+  Publish(shard_id);
+}
+
+void PcapParser::DispatchBuffer::Publish(size_t const shard_id) {
+  mLane.rings[shard_id].Publish();
+  // 已发布的包都不晚于当前包, 之后的包按文件顺序也不会更早
+  mLane.progress[shard_id].store(mArrive, std::memory_order_release);
+  Notify(*mParser.mShards[shard_id]);
+}
+
+bool PcapParser::DispatchBuffer::CountHeavy(FlowKey const& key,
+                                            uint64_t const hash,
+                                            uint64_t const now,
+                                            uint32_t const wire_len) {
+  uint32_t const need{ mParser.mCapture.packetsPerFlow };
+  // 不限包数或有活动超时时 shard 会一直要包, 不能在这里截断
+  if (need == 0 or ActiveTimeout(key.protocol) > 0) return false;
+  if (mSketch.Add(hash) < HEAVY_THRESHOLD) return false;
+  if (mHeavyWindow > 0 and now >= mHeavyGeneration + mHeavyWindow) {
+    PruneHeavy(now);
+  }
+
+  uint64_t const seen{ mParser.mWallClock ? GetTimestampUs() : now };
+  auto it{ mHeavy.find(key) };
+  if (it == mHeavy.end()) {
+    if (mHeavy.size() >= MAX_HEAVY_FLOWS) return false;
+    it = mHeavy.emplace(key, HeavyFlow{ .last = seen, .reported = seen }).first;
+  }
+  auto& heavy{ it->second };
+  // 空闲超时后 shard 会把它当作新流, 需要重新发够包; 之前的计数先交给旧流
+  uint64_t const idle{ IdleTimeout(key.protocol) };
+  if (idle != UINT64_MAX and seen > heavy.last + idle) {
+    SendTally(key, hash, heavy);
+    heavy.forwarded = 0;
+  }
+  heavy.last   = (std::max)(heavy.last, seen);
+  heavy.arrive = (std::max)(heavy.arrive, now);
+  if (heavy.forwarded < need) {
+    ++heavy.forwarded;
+    return false;
+  }
+  ++mCountedOnly;
+  ++heavy.packets;
+  heavy.bytes += wire_len;
+  // shard 靠汇总推进墓碑的 lastSeen, 至少每半个空闲超时汇总一次
+  if (heavy.packets >= TALLY_PACKETS or
+      (idle != UINT64_MAX and heavy.last - heavy.reported >= idle / 2)) {
+    SendTally(key, hash, heavy);
+  }
+  return true;
+}
+
+void PcapParser::DispatchBuffer::SendTally(FlowKey const& key,
+                                           uint64_t const hash,
+                                           HeavyFlow& heavy) {
+  heavy.reported = heavy.last;
+  if (heavy.packets == 0) return;
+  pcap_pkthdr hdr{};
+  hdr.ts.tv_sec  = static_cast<decltype(hdr.ts.tv_sec)>(heavy.arrive / 1000000);
+  hdr.ts.tv_usec = static_cast<decltype(hdr.ts.tv_usec)>(heavy.arrive % 1000000);
+  hdr.caplen     = heavy.packets;
+  hdr.len        = heavy.bytes;
+  auto raw{ mArena.Allocate(&hdr, nullptr, PacketMeta{ .key = key }, 0) };
+  Dispatch(PickShard(key, hash, heavy.arrive), std::move(raw));
+  heavy.packets = 0;
+  heavy.bytes   = 0;
+}
+
+void PcapParser::DispatchBuffer::PruneHeavy(uint64_t const now) {
+  // 与改派记录相同: 上一代开始前就没再出现的流已空闲超时
+  uint64_t const previous{ mHeavyGeneration };
+  mHeavyGeneration = now;
+  for (auto it{ mHeavy.begin() }; it != mHeavy.end();) {
+    if (it->second.arrive >= previous) {
+      ++it;
+      continue;
+    }
+    SendTally(it->first, HashFlowKey(it->first, global::opt.hashSeed),
+              it->second);
+    it = mHeavy.erase(it);
+  }
+}
+
+size_t PcapParser::DispatchBuffer::PickShard(FlowKey const& key,
+                                             uint64_t const hash,
+                                             uint64_t const now) {
+  size_t const home{ hash % mParser.mShardCount };
+  // 多个读线程分读同一文件时, 同一条流的包必须落到同一个 shard
+  if (not mExclusive) return home;
+
+  if (mSeen.GenerationStart() != mRoutesGeneration) PruneRoutes();
+  bool const seen{ mSeen.TestAndSet(hash, now) };
+  if (mRedirected[home] > 0) {
+    if (auto const it{ mRoutes.find(key) }; it != mRoutes.end()) {
+      it->second.last = now;
+      return it->second.shard;
+    }
+  }
+  // 见过的流(含假阳性)留在原 shard, 已有的包都在那里
+  if (seen) return home;
+
+  auto const depth{ [this](size_t const i) {
+    auto const& ring{ mLane.rings[i] };
+    return ring.SizeApprox() + ring.Unpublished();
+  } };
+  size_t const home_depth{ depth(home) };
+  if (home_depth <= HOT_RING_DEPTH) return home;
+  size_t target{ home };
+  size_t target_depth{ home_depth };
+  for (size_t i = 0; i < mParser.mShardCount; ++i) {
+    size_t const d{ depth(i) };
+    if (d < target_depth) {
+      target       = i;
+      target_depth = d;
+    }
+  }
+  // 只有明显更空时才改派
+  if (target_depth * 2 >= home_depth or mRoutes.size() >= MAX_ROUTES) {
+    return home;
+  }
+  mRoutes[key] = Route{ target, now };
+  ++mRedirected[home];
+  ++mRebalanced;
+  return target;
+}
+
+void PcapParser::DispatchBuffer::PruneRoutes() {
+  // 上一代开始前就没再出现的流已不在 filter 中, 再来会重新选 shard
+  uint64_t const previous{ mRoutesGeneration };
+  mRoutesGeneration = mSeen.GenerationStart();
+  std::erase_if(mRoutes, [this, previous](auto const& route) {
+    if (route.second.last >= previous) return false;
+    --mRedirected[HashFlowKey(route.first, global::opt.hashSeed) %
+                  mParser.mShardCount];
+    return true;
+  });
+}
+
+void PcapParser::DispatchBuffer::Flush() {
+  for (size_t i = 0; i < mParser.mShardCount; ++i) {
+    if (mLane.rings[i].Unpublished() == 0) continue;
+    Publish(i);
+  }
 }
 
 // === Shard工作线程 ===
-void PcapParser::RunShard(const int shardId, const std::stop_token& stop) {
-  auto& shard{ mShards[shardId] };
+void PcapParser::RunShard(size_t const shardId, const std::stop_token& stop) {
+  PinCurrentThread(mShardCpus, shardId);
+  // 绑核后再分配并初始化, 流表等落在本线程所在的 NUMA 节点
+  mShards[shardId] = std::make_unique<FlowShard>();
+  auto& shard{ *mShards[shardId] };
+  shard.id = shardId;
+  shard.flows.Seed(global::opt.hashSeed);
+  shard.foldNs.assign(mFormats.size(), 0);
+  mShardsReady.count_down();
   XLOG_INFO << "Shard[" << shardId << "] 启动";
 
+  auto next_scan{ std::chrono::steady_clock::now() + EXPIRY_SCAN_INTERVAL };
   while (!stop.stop_requested()) {
-    raw_packet_t pkt;
-    while (shard.packetQueue.try_dequeue(pkt)) {
-      auto key_opt = pkt->GetFlowKey();
-      if (!key_opt.has_value()) continue;
-      auto key = key_opt.value();
-      shard.flowMap[key].emplace_back(pkt);
-      shard.lastSeen[key] = pkt->ArriveTime();
-    }
-
-    uint64_t const now{ GetTimestampUs() };
-    for (auto it = shard.flowMap.begin(); it != shard.flowMap.end();) {
-      auto& [key, list]{ *it };
-      if (now - shard.lastSeen[key] <= 10'000'000) {
-        ++it;
-        continue;
+    // 没有包时帮写线程编码, 每次只取一条流, 之后先回来看环
+    if (PollPackets(shard) == 0 and not RunEncodeTask(shard.id)) {
+      // 置位后复查一次, 与读线程 Notify 中的顺序配对
+      shard.sleeping.store(true);
+      std::atomic_thread_fence(std::memory_order_seq_cst);
+      if (not HasPackets(shard)) {
+        // 有包立即醒来, 否则最多睡到下一次超时扫描
+        auto const wait{ std::chrono::duration_cast<std::chrono::microseconds>(
+          next_scan - std::chrono::steady_clock::now()) };
+        shard.wake.wait((std::max)(wait.count(), int64_t{ 0 }));
+      }
+      shard.sleeping.store(false, std::memory_order_relaxed);
+    }
+
+    if (global::memory.Over()) EvictFlows(shard);
+
+    if (std::chrono::steady_clock::now() >= next_scan) {
+      ExpireFlows(shard);
+      next_scan = std::chrono::steady_clock::now() + EXPIRY_SCAN_INTERVAL;
+    }
+
+    uint16_t source;
+    while (shard.eofQueue.try_dequeue(source)) FlushSource(shard, source);
+  }
+
+  // 输入结束: 处理完已到达的包和文件结束通知, 剩余的流全部 flush
+  DrainPackets(shard);
+  uint16_t source;
+  while (shard.eofQueue.try_dequeue(source)) FlushSource(shard, source);
+  size_t const flushed{ shard.flows.Size() };
+  shard.flows.ForEach(
+    [this, &shard](FlowEntry& entry) { RetireEntry(shard, entry); });
+  shard.flows.Clear();
+  shard.watermark.clear();
+  shard.progress.clear();
+  shard.readers.clear();
+  shard.timers.clear();
+  XLOG_INFO << "Shard[" << shardId << "] 退出, Flush count: " << flushed
+            << ", 包: " << shard.packets << ", 流: " << shard.flowCount;
+}
+
+size_t PcapParser::PollPackets(FlowShard& shard) {
+  std::array<raw_packet_t, DRAIN_BATCH> batch;
+  size_t total{ 0 };
+  size_t const lanes{ mLaneCount.load(std::memory_order_acquire) };
+  for (size_t l = 0; l < lanes; ++l) {
+    size_t const n{ mLanes[l]->rings[shard.id].PopBulk(batch.begin(),
+                                                       batch.size()) };
+    for (size_t i = 0; i < n; ++i) AddPacket(shard, std::move(batch[i]));
+    total += n;
+  }
+  return total;
+}
+
+void PcapParser::DrainPackets(FlowShard& shard) {
+  while (PollPackets(shard) > 0) {}
+}
+
+void PcapParser::DrainPublished(FlowShard& shard) {
+  size_t const lanes{ mLaneCount.load(std::memory_order_acquire) };
+  std::array<size_t, MAX_LANES> marks;
+  for (size_t l = 0; l < lanes; ++l) {
+    marks[l] = mLanes[l]->rings[shard.id].Published();
+  }
+  std::array<raw_packet_t, DRAIN_BATCH> batch;
+  for (size_t l = 0; l < lanes; ++l) {
+    auto& ring{ mLanes[l]->rings[shard.id] };
+    for (size_t head{ ring.Consumed() }; head != marks[l];
+         head = ring.Consumed()) {
+      size_t const n{ ring.PopBulk(batch.begin(),
+                                   (std::min)(batch.size(), marks[l] - head)) };
+      for (size_t i = 0; i < n; ++i) AddPacket(shard, std::move(batch[i]));
+    }
+  }
+}
+
+bool PcapParser::HasPackets(FlowShard const& shard) const {
+  size_t const lanes{ mLaneCount.load(std::memory_order_acquire) };
+  for (size_t l = 0; l < lanes; ++l) {
+    if (not mLanes[l]->rings[shard.id].Empty()) return true;
+  }
+  return false;
+}
+
+void PcapParser::AddPacket(FlowShard& shard, raw_packet_t&& pkt) {
+  auto const& key{ pkt->Key() };
+  int64_t const arrive{ pkt->ArriveTime() };
+  auto& mark{ shard.watermark[key.source] };
+  mark = (std::max)(mark, static_cast<uint64_t>(arrive));
+  uint64_t const seen{ mWallClock ? GetTimestampUs()
+                                  : static_cast<uint64_t>(arrive) };
+  if (pkt->IsTally()) {
+    // 读线程只计数的大流包: 只累加到还在的表项, 不新建流
+    if (auto const entry{ shard.flows.Find(key) }; entry != nullptr) {
+      entry->lastSeen = (std::max)(entry->lastSeen, seen);
+      entry->packets += pkt->info_hdr.caplen;
+      entry->bytes += pkt->info_hdr.len;
+    }
+    return;
+  }
+  auto const [entry, inserted]{ shard.flows.TryEmplace(key) };
+  ++shard.packets;
+  uint64_t const idle{ IdleTimeout(key.protocol) };
+  // 活动超时只看流自身的包时间, 两种时钟下一致
+  int64_t const active{ ActiveTimeout(key.protocol) };
+  if (inserted) {
+    ++shard.flowCount;
+    entry->shared = SharedSource(shard, key.source);
+    global::memory.Charge(FLOW_OVERHEAD);
+    // 新流登记一次超时, 之后到期时再按 lastSeen 顺延
+    if (idle != UINT64_MAX) {
+      shard.timers.try_emplace(key.source, seen)
+        .first->second.Schedule(key, seen + idle);
+    }
+  } else if (idle != UINT64_MAX and seen > entry->lastSeen + idle) {
+    // 已空闲超时但扫描还没轮到: 不能续上旧流, 在这里切分
+    RestartEntry(shard, *entry);
+  } else if (active > 0 and
+             (entry->state == FlowState::Satisfied or entry->Pending()) and
+             arrive - entry->start >= active) {
+    // 活动超时对墓碑同样生效, 之后的包开始新的一段
+    RestartEntry(shard, *entry);
+  }
+  entry->lastSeen = (std::max)(entry->lastSeen, seen);
+  ++entry->packets;
+  entry->bytes += pkt->info_hdr.len;
+  if (entry->state == FlowState::Satisfied) {
+    ++shard.skipped;
+    return;
+  }
+  // 多个读线程分读时包可能乱序, 段首取最早的包
+  entry->start = entry->Pending() ? (std::min)(entry->start, arrive) : arrive;
+
+  bool full;
+  if (not mEncoders.empty()) {
+    // 包折叠进各格式的编码器状态后即释放, 不在流表中缓存
+    if (entry->encoders.empty()) {
+      for (auto const make : mEncoders) {
+        auto& encoder{ entry->encoders.emplace_back(make()) };
+        global::memory.Charge(static_cast<int64_t>(encoder->Footprint()));
       }
-      mWriteQueue.enqueue({ key, std::move(list) });
-      shard.lastSeen.erase(key);
-      it = shard.flowMap.erase(it);
     }
-    std::this_thread::sleep_for(10ms);
+    // 所有格式都够用才算够用, 已够用的编码器忽略之后的包
+    full = true;
+    // 抽样计时, 相邻格式共用一次取时间
+    bool const timed{ shard.folded++ % FOLD_SAMPLE == 0 };
+    auto begin{ timed ? std::chrono::steady_clock::now()
+                      : std::chrono::steady_clock::time_point{} };
+    for (size_t f = 0; f < entry->encoders.size(); ++f) {
+      auto& encoder{ entry->encoders[f] };
+      size_t const footprint{ encoder->Footprint() };
+      full = encoder->Add(*pkt) and full;
+      if (timed) {
+        auto const end{ std::chrono::steady_clock::now() };
+        shard.foldNs[f] +=
+          std::chrono::duration_cast<std::chrono::nanoseconds>(end - begin)
+            .count();
+        begin = end;
+      }
+      // 状态按需增长, 只记增长的部分; 写出时按最终大小归还
+      if (size_t const grown{ encoder->Footprint() - footprint }; grown > 0) {
+        global::memory.Charge(static_cast<int64_t>(grown));
+      }
+    }
+  } else {
+    entry->list.emplace_back(std::move(pkt));
+    full = mCapture.Full(entry->list.size());
+    // 乱序时攒到两倍再按到达时间裁掉最晚的, 渲染只用最早的那些包
+    if (entry->shared and mCapture.Full(entry->list.size() / 2)) {
+      entry->list.sort([](raw_packet_t const& a, raw_packet_t const& b) {
+        return a->ArriveTime() < b->ArriveTime();
+      });
+      entry->list.erase(
+        std::next(entry->list.begin(), mCapture.packetsPerFlow),
+        entry->list.end());
+    }
   }
+  if (not full) return;
+  // 分段读取时更早的包可能还在其他读线程的环里, 留到超时或文件结束再写出
+  if (entry->shared) return;
 
-  for (auto& [key, list] : shard.flowMap) {
-    mWriteQueue.enqueue({ key, std::move(list) });
+  // 编码所需的包已齐: 立即写出, 表项留作墓碑挡住之后的包, 随流超时一起清除
+  EmitFlow(shard, *entry);
+  entry->state = FlowState::Satisfied;
+}
+
+void PcapParser::RestartEntry(FlowShard& shard, FlowEntry& entry) {
+  if (entry.state == FlowState::Active and entry.Pending()) {
+    EmitFlow(shard, entry);
   }
-  XLOG_INFO << "Shard[" << shardId
-            << "] 退出, Flush count: " << shard.flowMap.size();
+  // 表项和已登记的超时原样复用, 内容重置为一条新流
+  FlowKey const key{ entry.key };
+  bool const shared{ entry.shared };
+  entry = FlowEntry{ .key = key, .shared = shared };
+  ++shard.flowCount;
 }
 
-void PcapParser::RunWriter(const std::stop_token& stop) {
+void PcapParser::RetireEntry(FlowShard const& shard, FlowEntry& entry) {
+  if (entry.state == FlowState::Active and entry.Pending()) {
+    EmitFlow(shard, entry);
+  }
+  global::memory.Release(FLOW_OVERHEAD);
+}
+
+void PcapParser::ExpireFlows(FlowShard& shard) {
+  uint64_t const wall{ mWallClock ? GetTimestampUs() : 0 };
+  for (auto& [source, wheel] : shard.timers) {
+    uint64_t const now{ mWallClock ? wall : LowWatermark(shard, source) };
+    wheel.Advance(now, [&](FlowKey const& key) {
+      auto const entry{ shard.flows.Find(key) };
+      // 流已被驱逐且没有再出现
+      if (entry == nullptr) return;
+      uint64_t const deadline{ entry->lastSeen + IdleTimeout(key.protocol) };
+      if (now <= deadline) {
+        wheel.Schedule(key, deadline);
+        return;
+      }
+      RetireEntry(shard, *entry);
+      shard.flows.Erase(key);
+    });
+  }
+}
+
+uint64_t PcapParser::LowWatermark(FlowShard& shard, uint16_t const source) {
+  auto const job{ FindJob(source) };
+  size_t const count{ job->readerCount.load(std::memory_order_acquire) };
+  if (count == 0) return 0;
+  auto& marks{ shard.progress[source] };
+  marks.resize(count, 0);
+  uint64_t low{ UINT64_MAX };
+  for (size_t k = 0; k < count; ++k) {
+    auto& slot{ job->readers[k] };
+    auto& mark{ marks[k] };
+    if (slot.done.load(std::memory_order_acquire)) {
+      // 读完了: 发来的包都取完后不再限制水位
+      auto const& ring{ mLanes[slot.lane.load(std::memory_order_relaxed)]
+                          ->rings[shard.id] };
+      if (ring.Consumed() >= slot.tails[shard.id]) continue;
+    } else {
+      size_t const lane{ slot.lane.load(std::memory_order_acquire) };
+      // 还没开始的读线程可能从任何时间读起
+      if (lane == ReaderSlot::NO_LANE) return 0;
+      // 先取进度再取发布位置, 取完到该位置就取完了进度之前的所有包
+      uint64_t const time{
+        mLanes[lane]->progress[shard.id].load(std::memory_order_acquire)
+      };
+      auto const& ring{ mLanes[lane]->rings[shard.id] };
+      size_t const tail{ ring.Published() };
+      // 期间读完并交出 lane 的话, 进度可能已是其他文件的
+      if (not slot.done.load(std::memory_order_acquire) and
+          ring.Consumed() >= tail) {
+        mark = (std::max)(mark, time);
+      }
+    }
+    low = (std::min)(low, mark);
+  }
+  // 所有读线程都已读完且取完, 不会再有更早的包
+  return low == UINT64_MAX ? shard.watermark[source] : low;
+}
+
+void PcapParser::EvictFlows(FlowShard& shard) {
+  if (shard.flows.Empty()) return;
+  // 写队列积压时写出去也要等写线程才能释放, 只清理不缓存包的表项
+  bool const backlogged{ mEncodeTasks.SizeApprox() >=
+                         mWriterCount * EVICT_PENDING_PER_WRITER };
+
+  // 按最后活动时间取最久的一部分: 缓存着包的流提前写出并留作墓碑,
+  // 墓碑和没有缓存的流直接删除, 否则墓碑会占满预算让读线程一直阻塞
+  std::vector<std::pair<uint64_t, FlowKey>> by_age;
+  by_age.reserve(shard.flows.Size());
+  shard.flows.ForEach([&](FlowEntry const& entry) {
+    bool const buffered{ entry.state == FlowState::Active and entry.Pending() };
+    if (buffered and backlogged) return;
+    by_age.emplace_back(entry.lastSeen, entry.key);
+  });
+  if (by_age.empty()) return;
+  size_t const count{ (std::max)(by_age.size() / EVICT_DIVISOR, size_t{ 1 }) };
+  std::ranges::nth_element(by_age, by_age.begin() + (count - 1),
+                           [](auto const& a, auto const& b) {
+                             return a.first < b.first;
+                           });
+  for (size_t i = 0; i < count; ++i) {
+    auto const& key{ by_age[i].second };
+    auto const entry{ shard.flows.Find(key) };
+    if (entry->state == FlowState::Active and entry->Pending()) {
+      EmitFlow(shard, *entry);
+      entry->state = FlowState::Satisfied;
+      global::memory.CountEviction();
+    } else {
+      RetireEntry(shard, *entry);
+      shard.flows.Erase(key);
+      ++shard.dropped;
+    }
+  }
+}
+
+void PcapParser::FlushSource(FlowShard& shard, uint16_t const source) {
+  // 文件的所有包在通知之前已发布, 取到此刻的位置即可;
+  // 其他文件的读线程还在写的部分留给主循环, 不在这里追
+  DrainPublished(shard);
+  shard.flows.EraseIf([&](FlowEntry& entry) {
+    if (entry.key.source != source) return false;
+    RetireEntry(shard, entry);
+    return true;
+  });
+  shard.watermark.erase(source);
+  shard.progress.erase(source);
+  shard.readers.erase(source);
+  shard.timers.erase(source);
+  ReleaseJob(source);
+}
+
+void PcapParser::RunWriter(size_t const writerId) {
+  PinCurrentThread(mWriterCpus, writerId);
   XLOG_INFO << "写线程[" << std::this_thread::get_id() << "]启动";
-  flow_node_t node;
-  while (not stop.stop_requested()) {
-    if (mWriteQueue.try_dequeue(node)) {
-      WriteSession(node);
+  // 从不同的队列开始取, 写线程之间少争抢
+  size_t const home{ writerId % mShardCount };
+  EncodeTask task;
+  while (true) {
+    if (mEncodeTasks.WaitPop(home, task, EXPIRY_SCAN_INTERVAL)) {
+      WriteFlow(task);
       continue;
     }
-    if (stop.stop_requested()) { break; }
-    std::this_thread::sleep_for(10ms); // 🔕 idle 等待，防止空转烧CPU
+    if (not mWriteClosed.load(std::memory_order_acquire)) continue;
+    // 已关闭: 关闭之前提交的流此时一定能取到, 写完即退出
+    while (mEncodeTasks.TryPop(home, task)) WriteFlow(task);
+    break;
   }
 
   XLOG_INFO << "写线程[" << std::this_thread::get_id() << "]退出";
 }
 
-// === 写出PNG逻辑 ===
-void PcapParser::WriteSession(const flow_node_t& node) {
-  fs::path const save_path = fs::path{ global::opt.outdir } /
-    (std::to_string(node.first.ip1) + "-" + std::to_string(node.first.ip2) +
-     "-" + std::to_string(node.first.port1) + "-" +
-     std::to_string(node.first.port2) + "-" +
-     std::to_string(node.first.protocol) + ".png");
+bool PcapParser::RunEncodeTask(size_t const home) {
+  EncodeTask task;
+  if (not mEncodeTasks.TryPop(home, task)) return false;
+  WriteFlow(task);
+  return true;
+}
+
+void PcapParser::WriteFlow(EncodeTask& task) {
+  if (task.encoders.empty()) {
+    // 多个读线程并发分发时, 同一条流的包可能乱序入队
+    auto const by_time{ [](const raw_packet_t& a, const raw_packet_t& b) {
+      return a->ArriveTime() < b->ArriveTime();
+    } };
+    if (not std::is_sorted(task.packets.begin(), task.packets.end(), by_time)) {
+      task.packets.sort(by_time);
+    }
+  }
+  // 同一条流依次生成每个格式, 包只读取和缓存一次
+  for (size_t f = 0; f < mFormats.size(); ++f) {
+    auto const begin{ std::chrono::steady_clock::now() };
+    cv::Mat mat;
+    if (not task.encoders.empty()) {
+      auto& encoder{ task.encoders[f] };
+      global::memory.Release(static_cast<int64_t>(encoder->Footprint()));
+      mat = encoder->Finalize();
+      encoder.reset();
+    } else {
+      mat = Render(mFormats[f], task.packets);
+    }
+    auto const encoded{ std::chrono::steady_clock::now() };
+    WriteSession(task.key, task.start, f, mat);
+    auto const written{ std::chrono::steady_clock::now() };
+
+    auto& stats{ mFormatStats[f] };
+    ++stats.flows;
+    stats.encodeNs += std::chrono::duration_cast<std::chrono::nanoseconds>(
+                        encoded - begin)
+                        .count();
+    stats.writeNs += std::chrono::duration_cast<std::chrono::nanoseconds>(
+                       written - encoded)
+                       .count();
+  }
+  task.encoders.clear();
+  task.packets.clear();
+  ++FindJob(task.key.source)->flows;
+  ReleaseJob(task.key.source);
+}
 
+cv::Mat PcapParser::Render(std::string const& fmt,
+                           packet_list_t const& packets) {
   cv::Mat mat;
-  if (global::opt.outfmt == "tile") {
-    const Tile gray{ node.second };
+  if (fmt == "tile") {
+    const Tile gray{ packets };
     mat = gray.Matrix();
-  } else if (global::opt.outfmt == "mtf") {
-    const MTF mtf{ node.second };
+  } else if (fmt == "mtf") {
+    const MTF mtf{ packets };
     mat = mtf.Matrix();
-  } else if (global::opt.outfmt == "gaf") {
-    const GAF gaf{ node.second };
+  } else if (fmt == "gaf") {
+    const GAF gaf{ packets, GAF::FromOptions() };
     mat = gaf.getMatrix();
   }
+  return mat;
+}
+
+fs::path PcapParser::FormatDir(fs::path const& label,
+                               size_t const format) const {
+  fs::path dir{ global::opt.outdir };
+  if (mFormats.size() > 1) dir /= mFormats[format];
+  return label.empty() ? dir : dir / label;
+}
+
+// === 写出PNG逻辑 ===
+void PcapParser::WriteSession(FlowKey const& key, int64_t const start,
+                              size_t const format, cv::Mat const& mat) {
+  auto const job{ FindJob(key.source) };
+  auto const& context{ job->context };
+  // 同一五元组被超时切成多段时以段首包时间(µs)区分
+  fs::path const save_path = FormatDir(context.label, format) /
+    (context.prefix + std::to_string(key.ip1) + "-" +
+     std::to_string(key.ip2) + "-" + std::to_string(key.port1) + "-" +
+     std::to_string(key.port2) + "-" + std::to_string(key.protocol) + "-" +
+     std::to_string(start) + ".png");
 
   if (!cv::imwrite(save_path.string(), mat)) {
     XLOG_ERROR << "保存失败: " << save_path;
   }
 }
 
+uint64_t PcapParser::IdleTimeout(uint8_t const protocol) {
+  auto const& timeout{ protocol == IPPROTO_TCP ? global::opt.tcp
+                                               : global::opt.udp };
+  auto const idle{ std::chrono::microseconds{ timeout.idle }.count() };
+  // 0 表示不按空闲结束
+  return idle > 0 ? static_cast<uint64_t>(idle) : UINT64_MAX;
+}
+
+int64_t PcapParser::ActiveTimeout(uint8_t const protocol) {
+  auto const& timeout{ protocol == IPPROTO_TCP ? global::opt.tcp
+                                               : global::opt.udp };
+  return std::chrono::microseconds{ timeout.active }.count();
+}
+
 // === 当前时间（微秒）===
 uint64_t PcapParser::GetTimestampUs() {
   return std::chrono::duration_cast<std::chrono::microseconds>(
@@ -0,0 +1,245 @@
+//
+// Created by corgi on 2025 四月 20.
+//
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include <algorithm>
+#include <cstring>
+
+#include <ntv/pcap_reader.hh>
+#include <xlog/api.hh>
+
+namespace {
+constexpr uint32_t MAGIC_USEC         = 0xa1b2c3d4;
+constexpr uint32_t MAGIC_NSEC         = 0xa1b23c4d;
+constexpr uint32_t MAGIC_USEC_SWAPPED = 0xd4c3b2a1;
+constexpr uint32_t MAGIC_NSEC_SWAPPED = 0x4d3cb2a1;
+
+// Resync 时需要连续合理的记录头个数
+constexpr int RESYNC_CHAIN = 4;
+// 相邻记录时间戳允许的最大跳变(秒)
+constexpr uint32_t RESYNC_MAX_GAP = 3600;
+// 单条记录的长度上限, 与 libpcap 的 MAXIMUM_SNAPLEN 一致
+constexpr uint32_t MAX_RECORD_LEN = 262144;
+
+uint32_t ByteSwap32(uint32_t const v) {
+  return (v >> 24) | ((v >> 8) & 0x0000ff00) | ((v << 8) & 0x00ff0000) |
+    (v << 24);
+}
+} // namespace
+
+PcapReader::PcapReader(std::filesystem::path const& pcap_file) {
+#ifdef _WIN32
+  mFileHandle =
+    CreateFileW(pcap_file.wstring().c_str(), GENERIC_READ, FILE_SHARE_READ,
+                nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+  if (mFileHandle == INVALID_HANDLE_VALUE) {
+    mFileHandle = nullptr;
+    mError      = "无法打开文件: " + pcap_file.string();
+    return;
+  }
+  LARGE_INTEGER file_size{};
+  if (not GetFileSizeEx(mFileHandle, &file_size)) {
+    mError = "无法获取文件大小: " + pcap_file.string();
+    return;
+  }
+  mSize = static_cast<size_t>(file_size.QuadPart);
+  if (mSize < FILE_HEADER_SIZE) {
+    mError = "文件过小: " + pcap_file.string();
+    return;
+  }
+  mMappingHandle =
+    CreateFileMappingW(mFileHandle, nullptr, PAGE_READONLY, 0, 0, nullptr);
+  if (mMappingHandle == nullptr) {
+    mError = "CreateFileMapping 失败: " + pcap_file.string();
+    return;
+  }
+  auto const view{ MapViewOfFile(mMappingHandle, FILE_MAP_READ, 0, 0, 0) };
+  if (view == nullptr) {
+    mError = "MapViewOfFile 失败: " + pcap_file.string();
+    return;
+  }
+  mBase = static_cast<u_char const*>(view);
+#else
+  int const fd{ open(pcap_file.c_str(), O_RDONLY) };
+  if (fd < 0) {
+    mError = "无法打开文件: " + pcap_file.string();
+    return;
+  }
+  struct stat st{};
+  if (fstat(fd, &st) != 0) {
+    close(fd);
+    mError = "无法获取文件大小: " + pcap_file.string();
+    return;
+  }
+  mSize = static_cast<size_t>(st.st_size);
+  if (mSize < FILE_HEADER_SIZE) {
+    close(fd);
+    mError = "文件过小: " + pcap_file.string();
+    return;
+  }
+  void* view{ mmap(nullptr, mSize, PROT_READ, MAP_PRIVATE, fd, 0) };
+  close(fd);
+  if (view == MAP_FAILED) {
+    mError = "mmap 失败: " + pcap_file.string();
+    return;
+  }
+  madvise(view, mSize, MADV_SEQUENTIAL);
+  mBase = static_cast<u_char const*>(view);
+#endif
+
+  uint32_t magic{};
+  std::memcpy(&magic, mBase, sizeof(magic));
+  switch (magic) {
+  case MAGIC_USEC: break;
+  case MAGIC_NSEC: mNanosecond = true; break;
+  case MAGIC_USEC_SWAPPED: mSwapped = true; break;
+  case MAGIC_NSEC_SWAPPED:
+    mSwapped    = true;
+    mNanosecond = true;
+    break;
+  default:
+    // pcapng 等其他格式交给 libpcap 处理
+    mError = "不是经典 pcap 格式: " + pcap_file.string();
+    Close();
+    return;
+  }
+  mSnapLen  = Load32(mBase + 16);
+  mLinkType = static_cast<int>(Load32(mBase + 20) & 0x0fffffff);
+  if (mSnapLen == 0) mSnapLen = MAX_RECORD_LEN;
+  if (mSize >= FILE_HEADER_SIZE + RECORD_HEADER_SIZE) {
+    mFirstTs = Load32(mBase + FILE_HEADER_SIZE);
+  }
+}
+
+PcapReader::~PcapReader() { Close(); }
+
+void PcapReader::Close() {
+  if (mHasFilter) {
+    pcap_freecode(&mProgram);
+    mHasFilter = false;
+  }
+#ifdef _WIN32
+  if (mBase) UnmapViewOfFile(mBase);
+  if (mMappingHandle) CloseHandle(mMappingHandle);
+  if (mFileHandle) CloseHandle(mFileHandle);
+  mMappingHandle = nullptr;
+  mFileHandle    = nullptr;
+#else
+  if (mBase) munmap(const_cast<u_char*>(mBase), mSize);
+#endif
+  mBase = nullptr;
+}
+
+bool PcapReader::SetFilter(std::string const& expr) {
+  // 借用一个 dead handle 编译 BPF, 匹配时用 pcap_offline_filter 直接执行
+  pcap_t* dead{ pcap_open_dead(mLinkType, static_cast<int>(mSnapLen)) };
+  if (dead == nullptr) {
+    mError = "pcap_open_dead 失败";
+    return false;
+  }
+  if (mHasFilter) {
+    pcap_freecode(&mProgram);
+    mHasFilter = false;
+  }
+  if (pcap_compile(dead, &mProgram, expr.c_str(), 1, PCAP_NETMASK_UNKNOWN) ==
+      -1) {
+    mError = std::string{ "编译filter失败: " } + pcap_geterr(dead);
+    pcap_close(dead);
+    return false;
+  }
+  pcap_close(dead);
+  mHasFilter = true;
+  return true;
+}
+
+uint32_t PcapReader::Load32(u_char const* p) const {
+  uint32_t v{};
+  std::memcpy(&v, p, sizeof(v));
+  return mSwapped ? ByteSwap32(v) : v;
+}
+
+bool PcapReader::ReadHeader(size_t const offset, pcap_pkthdr& hdr) const {
+  if (offset + RECORD_HEADER_SIZE > mSize) return false;
+  u_char const* p{ mBase + offset };
+  uint32_t const ts_sec{ Load32(p) };
+  uint32_t const ts_frac{ Load32(p + 4) };
+  hdr.caplen = Load32(p + 8);
+  hdr.len    = Load32(p + 12);
+  hdr.ts.tv_sec  = ts_sec;
+  // 下游统一按微秒处理
+  hdr.ts.tv_usec = mNanosecond ? ts_frac / 1000 : ts_frac;
+  // 长度本身不合理的交给调用方当作错位处理
+  if (WellFormed(hdr) and offset + RECORD_HEADER_SIZE + hdr.caplen > mSize) {
+    XLOG_WARN << "pcap 末尾记录被截断, offset: " << offset;
+    return false;
+  }
+  return true;
+}
+
+bool PcapReader::WellFormed(pcap_pkthdr const& hdr) {
+  // 只查不会误伤正常文件的字段, 错位时随机的长度几乎不可能同时满足
+  return hdr.caplen <= MAX_RECORD_LEN and
+    static_cast<uint32_t>(hdr.ts.tv_usec) < 1'000'000;
+}
+
+bool PcapReader::Plausible(pcap_pkthdr const& hdr) const {
+  if (not WellFormed(hdr)) return false;
+  if (hdr.caplen == 0 or hdr.caplen > hdr.len) return false;
+  if (hdr.caplen > mSnapLen or hdr.len > MAX_RECORD_LEN) return false;
+  // 抓包时间不会早于文件中第一条记录太多
+  return static_cast<uint32_t>(hdr.ts.tv_sec) + RESYNC_MAX_GAP >= mFirstTs;
+}
+
+size_t PcapReader::Resync(size_t const offset, size_t const end) const {
+  for (size_t candidate = offset; candidate < end; ++candidate) {
+    size_t cursor{ candidate };
+    pcap_pkthdr prev{}, hdr{};
+    int chain{ 0 };
+    for (; chain < RESYNC_CHAIN; ++chain) {
+      // 恰好落在文件末尾也算连上
+      if (cursor == mSize) {
+        chain = RESYNC_CHAIN;
+        break;
+      }
+      if (cursor + RECORD_HEADER_SIZE > mSize) break;
+      u_char const* p{ mBase + cursor };
+      hdr.ts.tv_sec  = Load32(p);
+      hdr.ts.tv_usec = mNanosecond ? Load32(p + 4) / 1000 : Load32(p + 4);
+      hdr.caplen     = Load32(p + 8);
+      hdr.len        = Load32(p + 12);
+      if (not Plausible(hdr)) break;
+      if (chain > 0) {
+        auto const gap{ hdr.ts.tv_sec - prev.ts.tv_sec };
+        if (gap > RESYNC_MAX_GAP or -gap > RESYNC_MAX_GAP) break;
+      }
+      cursor += RECORD_HEADER_SIZE + hdr.caplen;
+      if (cursor > mSize) break;
+      prev = hdr;
+    }
+    if (chain == RESYNC_CHAIN) return candidate;
+  }
+  return end;
+}
+
+std::vector<size_t> PcapReader::Split(size_t const parts) const {
+  std::vector<size_t> bounds{ DataBegin() };
+  size_t const data_size{ mSize > DataBegin() ? mSize - DataBegin() : 0 };
+  size_t const span{ data_size / (std::max)(parts, size_t{ 1 }) };
+  for (size_t i = 1; i < parts and span > 0; ++i) {
+    size_t const start{ Resync(
+      (std::max)(DataBegin() + i * span, bounds.back()), mSize) };
+    if (start >= mSize) break;
+    if (start > bounds.back()) bounds.push_back(start);
+  }
+  bounds.push_back(mSize);
+  return bounds;
+}
@@ -18,11 +18,17 @@
 #include <xlog/api.hh>
 #define fake
 
-fake RawPacket::RawPacket(pcap_pkthdr const* pkthdr, u_char const* packet)
+fake RawPacket::RawPacket(pcap_pkthdr const* pkthdr, u_char const* packet,
+                          PacketMeta const& meta, uint32_t const length,
+                          PacketSlab* const slab)
     : info_hdr{ *pkthdr } // make a copy of the packet data
-{
-  byte_arr.reserve(pkthdr->caplen);
-  byte_arr.assign(packet, packet + pkthdr->caplen);
+    , meta{ meta }
+    , length{ length }
+    , slab{ slab } {
+  // 计数包没有字节数据, packet 可以为空
+  if (length > 0) {
+    std::memcpy(reinterpret_cast<u_char*>(this + 1), packet, length);
+  }
 }
 auto RawPacket::ArriveTime() const -> int64_t {
   std::chrono::seconds const sec{ info_hdr.ts.tv_sec };
@@ -32,55 +38,81 @@ auto RawPacket::ArriveTime() const -> int64_t {
   return duration.count();
 }
 auto RawPacket::ByteCount() const -> std::int64_t {
-  return std::int64_t(byte_arr.size());
+  return std::int64_t(length);
 }
 
-auto RawPacket::Data() const -> u_char const* { return byte_arr.data(); }
-auto RawPacket::Beg() const -> ustring_t::const_iterator {
-  return byte_arr.begin();
+auto RawPacket::Data() const -> u_char const* {
+  return reinterpret_cast<u_char const*>(this + 1);
 }
-auto RawPacket::End() const -> ustring_t::const_iterator {
-  return byte_arr.end();
+auto RawPacket::Beg() const -> u_char const* { return Data(); }
+auto RawPacket::End() const -> u_char const* {
+  return Data() + length;
 }
 
-std::optional<FlowKey> RawPacket::GetFlowKey() const {
-  u_char const* packet_data = byte_arr.data();
-  auto const* eth_hdr = reinterpret_cast<ether_header const*>(packet_data);
-  u_char const* ip_header_start = packet_data + sizeof(ether_header);
-
-  if (ntohs(eth_hdr->ether_type) == ETHERTYPE_VLAN) {
-    ip_header_start += sizeof(vlan_header);
+std::optional<PacketMeta> PacketMeta::Decode(u_char const* data,
+                                             uint32_t const caplen,
+                                             uint16_t const source) {
+  if (caplen < sizeof(ether_header)) return std::nullopt;
+  auto const* eth_hdr = reinterpret_cast<ether_header const*>(data);
+  uint16_t ether_type = ntohs(eth_hdr->ether_type);
+  size_t l3 = sizeof(ether_header);
+
+  if (ether_type == ETHERTYPE_VLAN) {
+    if (caplen < l3 + sizeof(vlan_header)) return std::nullopt;
+    auto const* vlan = reinterpret_cast<vlan_header const*>(data + l3);
+    ether_type = ntohs(vlan->etherType);
+    l3 += sizeof(vlan_header);
   }
 
-  if (ntohs(eth_hdr->ether_type) == ETHERTYPE_IPV6) return std::nullopt;
+  if (ether_type != ETHERTYPE_IP) return std::nullopt;
+  if (caplen < l3 + sizeof(ip)) return std::nullopt;
 
-  auto const* ip_hdr = reinterpret_cast<ip const*>(ip_header_start);
+  auto const* ip_hdr = reinterpret_cast<ip const*>(data + l3);
+  // 版本和首部长度直接取字节, Windows 下 missing.hh 的位域命名不同
+  size_t const ihl = data[l3] & 0x0F;
+  if ((data[l3] >> 4) != 4 || ihl < 5) return std::nullopt;
   if (ip_hdr->ip_p != IPPROTO_TCP && ip_hdr->ip_p != IPPROTO_UDP)
     return std::nullopt;
 
+  size_t const l4 = l3 + (ihl << 2);
   uint32_t ip1 = ntohl(ip_hdr->ip_src.s_addr);
   uint32_t ip2 = ntohl(ip_hdr->ip_dst.s_addr);
   uint16_t port1, port2;
+  size_t payload;
 
   if (ip_hdr->ip_p == IPPROTO_TCP) {
-    auto const* tcp_hdr =
-      reinterpret_cast<tcphdr const*>(ip_header_start + (ip_hdr->ip_hl << 2));
+    if (caplen < l4 + sizeof(tcphdr)) return std::nullopt;
+    auto const* tcp_hdr = reinterpret_cast<tcphdr const*>(data + l4);
     port1 = ntohs(tcp_hdr->th_sport);
     port2 = ntohs(tcp_hdr->th_dport);
+    payload = l4 + ((data[l4 + 12] >> 4) << 2);
   } else {
-    auto const* udp_hdr =
-      reinterpret_cast<udphdr const*>(ip_header_start + (ip_hdr->ip_hl << 2));
+    if (caplen < l4 + sizeof(udphdr)) return std::nullopt;
+    auto const* udp_hdr = reinterpret_cast<udphdr const*>(data + l4);
     port1 = ntohs(udp_hdr->uh_sport);
     port2 = ntohs(udp_hdr->uh_dport);
+    payload = l4 + sizeof(udphdr);
   }
+  payload = (std::min)(payload, size_t(caplen));
 
   // 规范化：小的IP+port在前
+  uint8_t direction = 0;
   if (ip1 > ip2 || (ip1 == ip2 && port1 > port2)) {
     std::swap(ip1, ip2);
     std::swap(port1, port2);
+    direction = 1;
   }
 
-  return FlowKey{ ip1, ip2, port1, port2, ip_hdr->ip_p };
+  return PacketMeta{
+    .key        = FlowKey{ ip1, ip2, port1, port2, ip_hdr->ip_p, source },
+    .l2         = 0,
+    .l3         = static_cast<uint16_t>(l3),
+    .l4         = static_cast<uint16_t>(l4),
+    .payload    = static_cast<uint16_t>(payload),
+    .payloadLen = static_cast<uint16_t>(
+      (std::min)(size_t(caplen) - payload, size_t(UINT16_MAX))),
+    .direction  = direction,
+  };
 }
 
 // peer
@@ -95,47 +127,26 @@ std::ostream& operator<<(std::ostream& os, Peer const& obj) {
 }
 
 
-std::optional<AlignedPacket> RawPacket::ToAligned() const {
-  u_char const* packet_data = byte_arr.data();
-  auto const* eth_hdr = reinterpret_cast<ether_header const*>(packet_data);
-  u_char const* ip_header_start = packet_data + sizeof(ether_header);
-
-  if (ntohs(eth_hdr->ether_type) == ETHERTYPE_VLAN) {
-    ip_header_start += sizeof(vlan_header);
-  }
-
-  if (ntohs(eth_hdr->ether_type) == ETHERTYPE_IPV6) return std::nullopt;
-
-  auto const* ip_hdr = reinterpret_cast<ip const*>(ip_header_start);
-  if (ip_hdr->ip_p != IPPROTO_TCP && ip_hdr->ip_p != IPPROTO_UDP)
-    return std::nullopt;
-
+AlignedPacket RawPacket::ToAligned() const {
+  u_char const* packet_data = Data();
+  u_char const* pkt_end = packet_data + length;
   std::array<u_char, 192> aligned{};
   size_t offset = 0;
 
   // === IP HEADER ===
-  size_t ip_len = ip_hdr->ip_hl * 4;
+  size_t ip_len = meta.l4 - meta.l3;
   size_t copy_len = (std::min)(ip_len, size_t(60));
-  std::memcpy(aligned.data() + offset, ip_header_start, copy_len);
+  std::memcpy(aligned.data() + offset, packet_data + meta.l3, copy_len);
   offset += 60;  // 固定偏移，无论实际 IP 长度是多少都填满
 
-  uint32_t ip1 = ntohl(ip_hdr->ip_src.s_addr);
-  uint32_t ip2 = ntohl(ip_hdr->ip_dst.s_addr);
-  uint16_t port1 = 0, port2 = 0;
-
   // === TCP / UDP HEADER ===
-  if (ip_hdr->ip_p == IPPROTO_TCP) {
-    auto const* tcp_hdr = reinterpret_cast<tcphdr const*>(ip_header_start + ip_len);
-    auto pkt_end = packet_data + byte_arr.size();
-    auto tcp_ptr = reinterpret_cast<u_char const*>(tcp_hdr);
-    size_t avail = pkt_end > tcp_ptr ? pkt_end - tcp_ptr : 0;
+  u_char const* l4_ptr = packet_data + meta.l4;
+  size_t avail = pkt_end > l4_ptr ? pkt_end - l4_ptr : 0;
+  if (meta.key.protocol == IPPROTO_TCP) {
     size_t tcp_copy = (std::min)(size_t(60), avail);
-    std::memcpy(aligned.data() + offset, tcp_ptr, tcp_copy);
+    std::memcpy(aligned.data() + offset, l4_ptr, tcp_copy);
     offset += 60;
 
-    port1 = ntohs(tcp_hdr->th_sport);
-    port2 = ntohs(tcp_hdr->th_dport);
-
     // 补充 UDP 头部全 0
     std::memset(aligned.data() + offset, 0, 8);
     offset += 8;
@@ -143,29 +154,19 @@ std::optional<AlignedPacket> RawPacket::ToAligned() const {
     // UDP 情况下填空 TCP 头
     offset += 60;
 
-    auto const* udp_hdr = reinterpret_cast<udphdr const*>(ip_header_start + ip_len);
-    std::memcpy(aligned.data() + offset, udp_hdr, 8);
-    port1 = ntohs(udp_hdr->uh_sport);
-    port2 = ntohs(udp_hdr->uh_dport);
+    std::memcpy(aligned.data() + offset, l4_ptr, (std::min)(size_t(8), avail));
     offset += 8;
   }
 
   // === PAYLOAD 64 ===
-  size_t header_size = ip_header_start - packet_data + ip_len;
-  if (header_size < byte_arr.size()) {
-    size_t payload_len = (std::min)(size_t(64), byte_arr.size() - header_size);
-    std::memcpy(aligned.data() + offset, packet_data + header_size, payload_len);
-  }
-  // offset += 128; // 不需要加，结构已预定义满 256
-
-  // === 规范化 KEY ===
-  if (ip1 > ip2 || (ip1 == ip2 && port1 > port2)) {
-    std::swap(ip1, ip2);
-    std::swap(port1, port2);
+  // 与原布局一致, 从 L4 头起取 64 字节
+  if (avail > 0) {
+    size_t payload_len = (std::min)(size_t(64), avail);
+    std::memcpy(aligned.data() + offset, l4_ptr, payload_len);
   }
 
   return AlignedPacket{
     .bytes = aligned,
-    .key = FlowKey{ ip1, ip2, port1, port2, ip_hdr->ip_p }
+    .key = meta.key
   };
 }
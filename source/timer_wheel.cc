@@ -0,0 +1,56 @@
+//
+// Created by corgi on 2025 四月 26.
+//
+
+#include <algorithm>
+
+#include <ntv/timer_wheel.hh>
+
+TimerWheel::TimerWheel(uint64_t const now_us) : mNow{ now_us / TICK_US } {}
+
+void TimerWheel::Schedule(FlowKey const& key, uint64_t const deadline_us) {
+  // 向上取整, 保证触发时 deadline 已过; 已到期的在下一个 tick 触发
+  uint64_t const tick{ (deadline_us + TICK_US - 1) / TICK_US };
+  Insert(Timer{ key, (std::max)(tick, mNow + 1) });
+  ++mSize;
+}
+
+void TimerWheel::Insert(Timer&& timer) {
+  // tick == mNow 只来自 Cascade, 落在马上要处理的当前槽
+  if (timer.tick - mNow >= RANGE) {
+    // 先在最远处触发一次, 由调用方重新登记
+    timer.tick = mNow + RANGE - 1;
+  }
+  uint64_t const delta{ timer.tick - mNow };
+  size_t level{ 0 };
+  while (level + 1 < LEVELS and
+         delta >= (uint64_t{ 1 } << (SLOT_BITS * (level + 1)))) {
+    ++level;
+  }
+  size_t const slot{ (timer.tick >> (SLOT_BITS * level)) & MASK };
+  mSlots[level][slot].emplace_back(std::move(timer));
+}
+
+void TimerWheel::Cascade(size_t const level) {
+  size_t const slot{ (mNow >> (SLOT_BITS * level)) & MASK };
+  if (slot == 0 and level + 1 < LEVELS) Cascade(level + 1);
+  slot_t timers;
+  std::swap(timers, mSlots[level][slot]);
+  for (auto& timer : timers) Insert(std::move(timer));
+}
+
+void TimerWheel::Rebase(uint64_t const tick) {
+  slot_t timers;
+  timers.reserve(mSize);
+  for (auto& level : mSlots) {
+    for (auto& slot : level) {
+      for (auto& timer : slot) timers.emplace_back(std::move(timer));
+      slot.clear();
+    }
+  }
+  mNow = tick;
+  for (auto& timer : timers) {
+    timer.tick = (std::max)(timer.tick, mNow + 1);
+    Insert(std::move(timer));
+  }
+}
@@ -0,0 +1,314 @@
+//
+// Created by corgi on 2025 五月 04.
+//
+// 热点组件的微基准, 不计入 ctest, 手动运行: ntv_bench [倍数] [pcap 文件]
+// 倍数放大每项的规模, 默认 1。给出 pcap 文件且找到了 libpcap 时,
+// 另外对比 mmap 与 libpcap 读取同一文件。
+//
+
+#include <array>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <random>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include <moodycamel/concurrent_queue.hh>
+#include <ntv/flow_table.hh>
+#include <ntv/nibble_transitions.hh>
+#include <ntv/packet_arena.hh>
+#include <ntv/spsc_ring.hh>
+#include <ntv/timer_wheel.hh>
+#ifdef NTV_BENCH_PCAP
+#include <ntv/pcap_reader.hh>
+#endif
+
+namespace {
+
+using bench_clock = std::chrono::steady_clock;
+
+double Seconds(bench_clock::time_point const begin) {
+  return std::chrono::duration<double>(bench_clock::now() - begin).count();
+}
+
+/// 防止结果被优化掉
+volatile uint64_t sink;
+
+void Report(char const* name, size_t const ops, double const seconds) {
+  std::printf("%-36s %10.1f ns/op %10.2f Mops/s\n", name, seconds * 1e9 / ops,
+              ops / seconds / 1e6);
+}
+
+std::vector<FlowKey> RandomKeys(size_t const n) {
+  std::mt19937_64 rng{ 42 };
+  std::vector<FlowKey> keys(n);
+  for (auto& key : keys) {
+    uint64_t const r{ rng() };
+    key = FlowKey{ static_cast<uint32_t>(r), static_cast<uint32_t>(r >> 32),
+                   static_cast<uint16_t>(rng()), 443, 6, 0 };
+  }
+  return keys;
+}
+
+// === 读线程 -> shard: SPSC 环 vs MPMC 队列 ===
+void BenchQueues(size_t const n) {
+  // 与 DispatchBuffer/PollPackets 相同: 攒 64 个发布一次, 一次取 256 个
+  {
+    auto ring{ std::make_unique<SpscRing<uint64_t, 2048>>() };
+    auto const begin{ bench_clock::now() };
+    std::jthread consumer{ [&] {
+      std::array<uint64_t, 256> batch;
+      uint64_t sum{ 0 };
+      for (size_t got = 0; got < n;) {
+        size_t const k{ ring->PopBulk(batch.begin(), batch.size()) };
+        if (k == 0) std::this_thread::yield();
+        for (size_t i = 0; i < k; ++i) sum += batch[i];
+        got += k;
+      }
+      sink = sum;
+    } };
+    for (uint64_t i = 0; i < n; ++i) {
+      uint64_t value{ i };
+      // 环满时与 DispatchBuffer 相同: 发布后让出, 等消费者
+      while (not ring->TryPush(std::move(value))) {
+        ring->Publish();
+        std::this_thread::yield();
+      }
+      if (ring->Unpublished() >= 64) ring->Publish();
+    }
+    ring->Publish();
+    consumer.join();
+    Report("SpscRing 批量发布", n, Seconds(begin));
+  }
+  {
+    moodycamel::ConcurrentQueue<uint64_t> queue;
+    auto const begin{ bench_clock::now() };
+    std::jthread consumer{ [&] {
+      moodycamel::ConsumerToken token{ queue };
+      std::array<uint64_t, 256> batch;
+      uint64_t sum{ 0 };
+      for (size_t got = 0; got < n;) {
+        size_t const k{ queue.try_dequeue_bulk(token, batch.begin(),
+                                               batch.size()) };
+        if (k == 0) std::this_thread::yield();
+        for (size_t i = 0; i < k; ++i) sum += batch[i];
+        got += k;
+      }
+      sink = sum;
+    } };
+    moodycamel::ProducerToken token{ queue };
+    for (uint64_t i = 0; i < n; ++i) queue.enqueue(token, i);
+    consumer.join();
+    Report("ConcurrentQueue 带 token", n, Seconds(begin));
+  }
+}
+
+// === 流表: Robin Hood vs std::unordered_map ===
+void BenchFlowTable(size_t const n) {
+  auto const keys{ RandomKeys(n) };
+  {
+    FlowTable table{ 0, 7 };
+    auto begin{ bench_clock::now() };
+    for (auto const& key : keys) table.TryEmplace(key).first->packets = 1;
+    Report("FlowTable 插入", n, Seconds(begin));
+    begin = bench_clock::now();
+    uint64_t sum{ 0 };
+    for (auto const& key : keys) sum += table.Find(key)->packets;
+    Report("FlowTable 命中查找", n, Seconds(begin));
+    begin = bench_clock::now();
+    for (auto const& key : keys) table.Erase(key);
+    Report("FlowTable 删除", n, Seconds(begin));
+    sink = sum;
+  }
+  {
+    std::unordered_map<FlowKey, FlowEntry> table;
+    auto begin{ bench_clock::now() };
+    for (auto const& key : keys) {
+      table.try_emplace(key).first->second.packets = 1;
+    }
+    Report("unordered_map 插入", n, Seconds(begin));
+    begin = bench_clock::now();
+    uint64_t sum{ 0 };
+    for (auto const& key : keys) sum += table.find(key)->second.packets;
+    Report("unordered_map 命中查找", n, Seconds(begin));
+    begin = bench_clock::now();
+    for (auto const& key : keys) table.erase(key);
+    Report("unordered_map 删除", n, Seconds(begin));
+    sink = sum;
+  }
+}
+
+// === 时间轮: 每条流登记一次, 到期时一半顺延(仍活跃), 一半结束 ===
+void BenchTimerWheel(size_t const n) {
+  auto const keys{ RandomKeys(n) };
+  constexpr uint64_t idle{ 10'000'000 };
+  constexpr uint64_t step{ 100'000 };
+  uint64_t const start{ 1'700'000'000'000'000 };
+  TimerWheel wheel{ start };
+  std::mt19937_64 rng{ 7 };
+
+  auto begin{ bench_clock::now() };
+  for (auto const& key : keys) {
+    wheel.Schedule(key, start + idle + rng() % idle);
+  }
+  Report("TimerWheel 登记", n, Seconds(begin));
+
+  size_t fired{ 0 };
+  begin = bench_clock::now();
+  for (uint64_t now = start; wheel.Size() > 0; now += step) {
+    wheel.Advance(now, [&](FlowKey const& key) {
+      if (++fired % 2 == 0 and fired <= n) wheel.Schedule(key, now + idle);
+    });
+  }
+  Report("TimerWheel 到期(含顺延)", fired, Seconds(begin));
+}
+
+// === 半字节转移: 向量化核 vs 逐半字节 ===
+void BenchNibble(size_t const packets) {
+  constexpr size_t packet_len{ 1500 };
+  std::vector<u_char> data(packets * packet_len);
+  std::mt19937 rng{ 1 };
+  for (auto& b : data) b = static_cast<u_char>(rng());
+
+  transition_counts_t counts{};
+  auto begin{ bench_clock::now() };
+  for (size_t i = 0; i < packets; ++i) {
+    CountNibbleTransitions(data.data() + i * packet_len, packet_len, counts);
+  }
+  double const kernel{ Seconds(begin) };
+  sink = counts[0];
+
+  counts.fill(0);
+  begin = bench_clock::now();
+  for (size_t i = 0; i < packets; ++i) {
+    u_char const* p{ data.data() + i * packet_len };
+    int prev{ -1 };
+    for (size_t j = 0; j < packet_len; ++j) {
+      for (int const nibble : { p[j] >> 4, p[j] & 0x0F }) {
+        if (prev >= 0) ++counts[(prev << 4) | nibble];
+        prev = nibble;
+      }
+    }
+  }
+  double const naive{ Seconds(begin) };
+  sink = counts[0];
+
+  double const mb{ static_cast<double>(data.size()) / (1 << 20) };
+  std::printf("%-36s %10.1f MB/s\n", "半字节转移 向量化核", mb / kernel);
+  std::printf("%-36s %10.1f MB/s\n", "半字节转移 逐半字节", mb / naive);
+}
+
+// === 包分配: slab 竞技场 vs 每包 new ===
+void BenchArena(size_t const n) {
+  std::array<u_char, 128> bytes{};
+  pcap_pkthdr hdr{};
+  hdr.caplen = hdr.len = static_cast<uint32_t>(bytes.size());
+  PacketMeta const meta{};
+  {
+    std::vector<raw_packet_t> held;
+    held.reserve(n);
+    PacketArena arena;
+    auto const begin{ bench_clock::now() };
+    for (size_t i = 0; i < n; ++i) {
+      held.push_back(arena.Allocate(&hdr, bytes.data(), meta, 128));
+    }
+    held.clear();
+    Report("PacketArena 分配+释放", n, Seconds(begin));
+  }
+  {
+    std::vector<std::unique_ptr<u_char[]>> held;
+    held.reserve(n);
+    auto const begin{ bench_clock::now() };
+    for (size_t i = 0; i < n; ++i) {
+      auto& p{ held.emplace_back(new u_char[sizeof(RawPacket) + 128]) };
+      std::memcpy(p.get() + sizeof(RawPacket), bytes.data(), 128);
+    }
+    held.clear();
+    Report("每包 new 分配+释放", n, Seconds(begin));
+  }
+}
+
+#ifdef NTV_BENCH_PCAP
+// === 读文件: mmap 遍历 vs libpcap pcap_loop, 同一文件, 不过滤 ===
+void BenchReaders(char const* path) {
+  PcapReader reader{ path };
+  if (not reader.IsOpen()) {
+    std::printf("mmap 无法读取 %s: %s\n", path, reader.Error().c_str());
+    return;
+  }
+  auto const walk{ [&reader] {
+    uint64_t bytes{ 0 };
+    auto const result{ reader.Walk(
+      reader.DataBegin(), reader.Size(),
+      [&bytes](pcap_pkthdr const* hdr, u_char const* data) {
+        bytes += hdr->caplen + (hdr->caplen > 0 ? data[0] : 0);
+      }) };
+    sink = bytes;
+    return result.records;
+  } };
+  // 先整体读一遍, 两种方式都从页缓存读
+  walk();
+  double const mb{ static_cast<double>(reader.Size()) / (1 << 20) };
+
+  auto begin{ bench_clock::now() };
+  uint64_t const records{ walk() };
+  double const mmap{ Seconds(begin) };
+  Report("PcapReader::Walk", records, mmap);
+  std::printf("%-36s %10.1f MB/s\n", "PcapReader::Walk", mb / mmap);
+
+  std::array<char, PCAP_ERRBUF_SIZE> err{};
+  pcap_t* handle{ pcap_open_offline(path, err.data()) };
+  if (handle == nullptr) {
+    std::printf("libpcap 无法读取 %s: %s\n", path, err.data());
+    return;
+  }
+  struct Count {
+    uint64_t records;
+    uint64_t bytes;
+  } count{};
+  begin = bench_clock::now();
+  pcap_loop(
+    handle, 0,
+    [](u_char* user, pcap_pkthdr const* hdr, u_char const* data) {
+      auto const c{ reinterpret_cast<Count*>(user) };
+      ++c->records;
+      c->bytes += hdr->caplen + (hdr->caplen > 0 ? data[0] : 0);
+    },
+    reinterpret_cast<u_char*>(&count));
+  double const loop{ Seconds(begin) };
+  pcap_close(handle);
+  sink = count.bytes;
+  Report("pcap_loop", count.records, loop);
+  std::printf("%-36s %10.1f MB/s\n", "pcap_loop", mb / loop);
+  if (count.records != records) {
+    std::printf("包数不一致: mmap %llu, libpcap %llu\n",
+                static_cast<unsigned long long>(records),
+                static_cast<unsigned long long>(count.records));
+  }
+}
+#endif
+
+} // namespace
+
+int main(int argc, char** argv) {
+  size_t const scale{ argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 1 };
+  if (scale == 0) {
+    std::printf("用法: ntv_bench [倍数] [pcap 文件], 倍数至少为 1\n");
+    return 1;
+  }
+  BenchQueues(scale * 20'000'000);
+  BenchFlowTable(scale * 1'000'000);
+  BenchTimerWheel(scale * 1'000'000);
+  BenchNibble(scale * 50'000);
+  BenchArena(scale * 5'000'000);
+#ifdef NTV_BENCH_PCAP
+  if (argc > 2) BenchReaders(argv[2]);
+#else
+  if (argc > 2) std::printf("没有找到 libpcap, 跳过读文件对比\n");
+#endif
+  return 0;
+}
@@ -0,0 +1,101 @@
+//
+// Created by corgi on 2025 五月 04.
+//
+// 半字节转移核与逐半字节参考实现的对照, 覆盖短输入、整批和尾部。
+// 同一份源码按默认/标量/AVX2 分别编译, 见 test/CMakeLists.txt。
+//
+
+#include <cmath>
+#include <cstdio>
+#include <random>
+#include <vector>
+
+#include <ntv/nibble_transitions.hh>
+
+namespace {
+
+/// 参考实现: 逐个半字节(每字节先高后低)累加相邻转移
+transition_counts_t Reference(u_char const* data, size_t const len) {
+  transition_counts_t counts{};
+  std::vector<u_char> nibbles;
+  for (size_t i = 0; i < len; ++i) {
+    nibbles.push_back(data[i] >> 4);
+    nibbles.push_back(data[i] & 0x0F);
+  }
+  for (size_t i = 0; i + 1 < nibbles.size(); ++i) {
+    ++counts[(nibbles[i] << 4) | nibbles[i + 1]];
+  }
+  return counts;
+}
+
+int failures{ 0 };
+
+void Check(std::vector<u_char> const& data, size_t const offset,
+           size_t const len) {
+  // 预置非零计数, 确认核是累加而不是覆盖
+  transition_counts_t counts{};
+  counts.fill(1);
+  CountNibbleTransitions(data.data() + offset, len, counts);
+  auto expected{ Reference(data.data() + offset, len) };
+  for (auto& count : expected) ++count;
+  if (counts != expected) {
+    std::printf("计数不一致: offset %zu, len %zu\n", offset, len);
+    ++failures;
+  }
+}
+
+void CheckTile() {
+  transition_counts_t counts{};
+  for (size_t i = 0; i < counts.size(); ++i) counts[i] = (i * 7919) % 13;
+  // 第 3 行全零
+  for (size_t col = 0; col < 16; ++col) counts[3 * 16 + col] = 0;
+  constexpr size_t stride{ 20 };
+  std::vector<u_char> out(16 * stride, 0xAA);
+  WriteTransitionTile(counts, out.data(), stride);
+  for (size_t row = 0; row < 16; ++row) {
+    double sum{ 0 };
+    for (size_t col = 0; col < 16; ++col) sum += counts[row * 16 + col];
+    for (size_t col = 0; col < 16; ++col) {
+      long const expected{ sum == 0 ? 0
+                                    : std::lrint(255.0 * counts[row * 16 + col] /
+                                                 sum) };
+      if (out[row * stride + col] != expected) {
+        std::printf("图像块不一致: row %zu, col %zu\n", row, col);
+        ++failures;
+      }
+    }
+    // 行尾之外的字节不能被写
+    for (size_t col = 16; col < stride; ++col) {
+      if (out[row * stride + col] != 0xAA) {
+        std::printf("图像块越界写: row %zu, col %zu\n", row, col);
+        ++failures;
+      }
+    }
+  }
+}
+
+} // namespace
+
+int main() {
+  std::mt19937 rng{ 20250504 };
+  std::uniform_int_distribution<int> byte{ 0, 255 };
+  std::vector<u_char> data(4096 + 64);
+  for (auto& b : data) b = static_cast<u_char>(byte(rng));
+
+  // 覆盖短输入分支、整批边界前后和非对齐起点
+  for (size_t len = 0; len <= 300; ++len) {
+    for (size_t offset = 0; offset < 4; ++offset) Check(data, offset, len);
+  }
+  for (size_t const len : { 1499, 1500, 1514, 4096 }) Check(data, 7, len);
+  // 重复字节: 相同下标连续出现
+  std::vector<u_char> same(1024, 0x5A);
+  Check(same, 0, same.size());
+
+  CheckTile();
+  if (failures > 0) {
+    std::printf("失败: %d\n", failures);
+    return 1;
+  }
+  std::printf("通过\n");
+  return 0;
+}